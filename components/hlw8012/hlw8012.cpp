@@ -1,44 +1,175 @@
 #include "hlw8012.h"
+#include "esphome/core/helpers.h"
 #include "esphome/core/log.h"
 
+#ifdef USE_API
+#include "esphome/components/api/api_server.h"
+#endif
+
+#include <algorithm>
+#include <cmath>
+
 namespace esphome::hlw8012 {
 
 static const char *const TAG = "hlw8012";
 
-// valid for HLW8012 and CSE7759
-static const uint32_t HLW8012_CLOCK_FREQUENCY = 3579000;
+// Published values are in micro-units
+static const float HLW8012_VALUE_SCALE = 1e6f;
+// Adaptive switching gives up waiting for CF1 to settle after this many updates, e.g. at zero current
+static const uint8_t HLW8012_ADAPTIVE_MAX_WINDOWS = 4;
+// A quantity changing at least this many times faster than the other keeps SEL for up to this many readings
+static const float HLW8012_ADAPTIVE_BIAS = 2.0f;
+static const uint8_t HLW8012_ADAPTIVE_MAX_RUN = 3;
+
+void HLW8012EdgeStore::setup(InternalGPIOPin *pin) {
+  pin->setup();
+  pin->attach_interrupt(HLW8012EdgeStore::gpio_intr, this, gpio::INTERRUPT_RISING_EDGE);
+}
+
+void IRAM_ATTR HLW8012EdgeStore::gpio_intr(HLW8012EdgeStore *arg) {
+  const uint32_t now = micros();
+  const uint32_t period = now - arg->last_edge;
+  arg->edge_period = period;
+  if (arg->period_edges < 2)
+    arg->period_edges = arg->period_edges + 1;
+  if (arg->settling) {
+    const uint32_t previous = arg->settle_period;
+    arg->last_edge = now;
+    arg->settle_period = period;
+    // Settled once two consecutive periods agree to within 1/16
+    if (previous == 0 || (period > previous ? period - previous : previous - period) > period / 16)
+      return;
+    arg->settling = false;
+  }
+  if (arg->edges == 0)
+    arg->first_edge = now;
+  arg->last_edge = now;
+  arg->edges = arg->edges + 1;
+}
+
+void HLW8012EdgeStore::reset(bool settle) {
+  {
+    InterruptLock lock;
+    this->edges = 0;
+    this->settle_period = 0;
+    this->settling = settle;
+  }
+  this->reset_at = micros();
+  this->tracker.reset();
+}
+
+HLW8012Reading HLW8012EdgeStore::read(uint32_t now) {
+  uint32_t edges, first_edge, last_edge;
+  {
+    InterruptLock lock;
+    edges = this->edges;
+    first_edge = this->first_edge;
+    last_edge = this->last_edge;
+    this->edges = 0;
+  }
+
+  return this->tracker.take(edges, first_edge, last_edge, now);
+}
+
+void OverloadTrigger::check(uint32_t period, float power, uint32_t now) {
+  if (period > this->threshold_period_) {
+    this->overloaded_since_ = 0;
+    this->tripped_ = false;
+    return;
+  }
+  if (this->tripped_)
+    return;
+  if (this->overloaded_since_ == 0) {
+    // 0 marks the trigger as disarmed, a start at exactly 0 ms only shifts it by 1 ms
+    this->overloaded_since_ = now | 1;
+  }
+  if (now - this->overloaded_since_ >= this->duration_) {
+    this->tripped_ = true;
+    this->trigger(power);
+  }
+}
 
 void HLW8012Component::setup() {
-  float reference_voltage = 0;
-  this->sel_pin_->setup();
-  this->sel_pin_->digital_write(this->current_mode_);
-  this->cf_store_.pulse_counter_setup(this->cf_pin_);
-  this->cf1_store_.pulse_counter_setup(this->cf1_pin_);
-
-  // Initialize multipliers
-  if (this->sensor_model_ == HLW8012_SENSOR_MODEL_BL0937) {
-    reference_voltage = 1.218f;
-    this->power_multiplier_ =
-        reference_voltage * reference_voltage * this->voltage_divider_ / this->current_resistor_ / 4596355.0f;
-    this->current_multiplier_ = reference_voltage / this->current_resistor_ / 222170.0f;
-    this->voltage_multiplier_ = reference_voltage * this->voltage_divider_ / 39576.0f;
+  if (this->sel_pin_ != nullptr) {
+    this->sel_pin_->setup();
+    this->set_mode_(this->current_mode_);
+  }
+  if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_PERIOD) {
+    this->cf_edges_.setup(this->cf_pin_);
+    this->cf1_edges_.setup(this->cf1_pin_);
   } else {
-    // HLW8012 and CSE7759 have same reference specs
-    reference_voltage = 2.43f;
-    this->power_multiplier_ = reference_voltage * reference_voltage * this->voltage_divider_ / this->current_resistor_ *
-                              64.0f / 24.0f / HLW8012_CLOCK_FREQUENCY;
-    this->current_multiplier_ = reference_voltage / this->current_resistor_ * 512.0f / 24.0f / HLW8012_CLOCK_FREQUENCY;
-    this->voltage_multiplier_ = reference_voltage * this->voltage_divider_ * 256.0f / HLW8012_CLOCK_FREQUENCY;
+    this->cf_store_.pulse_counter_setup(this->cf_pin_);
+    this->cf1_store_.pulse_counter_setup(this->cf1_pin_);
   }
+
+  if (this->restore_energy_ && this->energy_sensor_ != nullptr)
+    this->load_energy_();
+
+  if (this->sample_interval_ != 0)
+    this->set_interval("sample", this->sample_interval_, [this]() { this->sample_(); });
+
+  // The overload check is the only thing loop() does
+  if (this->overload_triggers_.empty())
+    this->disable_loop();
+}
+
+void HLW8012Component::loop() {
+  uint32_t last_edge, edge_period;
+  uint8_t period_edges;
+  {
+    InterruptLock lock;
+    last_edge = this->cf_edges_.last_edge;
+    edge_period = this->cf_edges_.edge_period;
+    period_edges = this->cf_edges_.period_edges;
+  }
+  // Without two edges there is no period, only the time since boot or since micros() wrapped
+  uint32_t period = UINT32_MAX;
+  if (period_edges >= 2) {
+    const uint32_t elapsed = micros() - last_edge;
+    if (elapsed > HLW8012_MAX_PERIOD_US) {
+      // No power. The period is forgotten well before micros() wraps, or the next edge would measure a period
+      // from the wrapped time.
+      InterruptLock lock;
+      if (this->cf_edges_.last_edge == last_edge)
+        this->cf_edges_.period_edges = 0;
+    } else {
+      // Once no edge has come for longer than the last period, the current period is at least that long
+      period = std::max(edge_period, elapsed);
+    }
+  }
+  const float power = period != 0 && period != UINT32_MAX ? this->power_multiplier_ / 1000.0f / period : 0.0f;
+  const uint32_t now = millis();
+  for (auto *trigger : this->overload_triggers_)
+    trigger->check(period, power, now);
 }
 void HLW8012Component::dump_config() {
   ESP_LOGCONFIG(TAG,
                 "HLW8012:\n"
                 "  Change measurement mode every %" PRIu32 "\n"
-                "  Current resistor: %.1f mΩ\n"
-                "  Voltage Divider: %.1f",
-                this->change_mode_every_, this->current_resistor_ * 1000.0f, this->voltage_divider_);
-  LOG_PIN("  SEL Pin: ", this->sel_pin_);
+                "  Multipliers: %" PRIu64 " nW/Hz, %" PRIu64 " nA/Hz, %" PRIu64 " nV/Hz\n"
+                "  Measurement mode: %s",
+                this->change_mode_every_, this->power_multiplier_, this->current_multiplier_, this->voltage_multiplier_,
+                this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_PERIOD ? "edge period" : "pulse count");
+  if (this->adaptive_mode_switching_)
+    ESP_LOGCONFIG(TAG, "  Change measurement mode once CF1 has settled");
+  if (this->restore_energy_)
+    ESP_LOGCONFIG(TAG,
+                  "  Energy save delta: %" PRIu64 " pulses\n"
+                  "  Energy save interval: %" PRIu32 " ms",
+                  this->energy_save_delta_, this->energy_save_interval_);
+  if (this->history_.enabled())
+    ESP_LOGCONFIG(TAG, "  History: flushed in batches of %u every %" PRIu32 " ms", this->history_batch_size_,
+                  this->history_flush_interval_);
+  if (this->sel_pin_ != nullptr) {
+    LOG_PIN("  SEL Pin: ", this->sel_pin_);
+  } else {
+    ESP_LOGCONFIG(TAG, "  SEL: following another chip");
+  }
+  if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_COUNT)
+    ESP_LOGCONFIG(TAG,
+                  "  CF counter: %s\n"
+                  "  CF1 counter: %s",
+                  this->cf_pcnt_ ? "hardware" : "interrupt", this->cf1_pcnt_ ? "hardware" : "interrupt");
   LOG_PIN("  CF Pin: ", this->cf_pin_);
   LOG_PIN("  CF1 Pin: ", this->cf1_pin_);
   LOG_UPDATE_INTERVAL(this);
@@ -46,61 +177,346 @@ void HLW8012Component::dump_config() {
   LOG_SENSOR("  ", "Current", this->current_sensor_);
   LOG_SENSOR("  ", "Power", this->power_sensor_);
   LOG_SENSOR("  ", "Energy", this->energy_sensor_);
+  LOG_SENSOR("  ", "Apparent Power", this->apparent_power_sensor_);
+  LOG_SENSOR("  ", "Power Factor", this->power_factor_sensor_);
+  if (this->sample_interval_ != 0) {
+    ESP_LOGCONFIG(TAG, "  Power sample interval: %" PRIu32 " ms", this->sample_interval_);
+    LOG_SENSOR("  ", "Power Min", this->power_min_sensor_);
+    LOG_SENSOR("  ", "Power Max", this->power_max_sensor_);
+    LOG_SENSOR("  ", "Power Mean", this->power_mean_sensor_);
+    LOG_SENSOR("  ", "Power Peak", this->power_peak_sensor_);
+  }
 }
-void HLW8012Component::update() {
-  // HLW8012 has 50% duty cycle
+HLW8012Reading HLW8012Component::read_cf_(uint32_t window_us) {
+  if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_PERIOD)
+    return this->cf_edges_.read(micros());
   pulse_counter::pulse_counter_t raw_cf = this->cf_store_.read_raw_value();
+  // don't count single pulse as power
+  return {(uint32_t) raw_cf, raw_cf <= 1 ? 0 : (uint32_t) raw_cf, window_us};
+}
+
+HLW8012Reading HLW8012Component::read_cf1_() {
+  if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_PERIOD)
+    return this->cf1_edges_.read(micros());
   pulse_counter::pulse_counter_t raw_cf1 = this->cf1_store_.read_raw_value();
-  float cf_hz = raw_cf / (this->get_update_interval() / 1000.0f);
-  if (raw_cf <= 1) {
+  // don't count single pulse as anything
+  return {(uint32_t) raw_cf1, raw_cf1 <= 1 ? 0 : (uint32_t) raw_cf1, this->get_update_interval() * 1000};
+}
+
+void HLW8012Component::update() {
+  // HLW8012 has 50% duty cycle
+  uint32_t cf_pulses;
+  uint64_t power_uw;
+  if (this->sample_interval_ != 0) {
+    // CF is read by sample_(), power comes from the pulses of all samples since the last update, just like a
+    // single read of CF over the update interval. A sample alone holds too few pulses at low power.
+    HLW8012Reading cf = this->sampled_cf_;
     // don't count single pulse as power
-    cf_hz = 0.0f;
-  }
-  float cf1_hz = raw_cf1 / (this->get_update_interval() / 1000.0f);
-  if (raw_cf1 <= 1) {
-    // don't count single pulse as anything
-    cf1_hz = 0.0f;
+    if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_COUNT && cf.periods <= 1)
+      cf.periods = 0;
+    // Without an edge in any sample, the latest one bounds the period by the time since the last edge
+    if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_PERIOD && cf.periods == 0)
+      cf = {cf.pulses, this->last_sample_.periods, this->last_sample_.span_us};
+    cf_pulses = cf.pulses;
+    power_uw = cf.span_us != 0 ? cf.scale(this->power_multiplier_) : 0;
+    this->sampled_cf_ = {0, 0, 0};
+  } else {
+    HLW8012Reading cf = this->read_cf_(this->get_update_interval() * 1000);
+    cf_pulses = cf.pulses;
+    power_uw = cf.scale(this->power_multiplier_);
   }
+  HLW8012Reading cf1 = this->read_cf1_();
+  // One time for all readings of this update, so they line up exactly in the histories
+  this->reading_time_ = millis();
 
   if (this->nth_value_++ < 2) {
     return;
   }
 
-  float power = cf_hz * this->power_multiplier_;
+  float power = power_uw / HLW8012_VALUE_SCALE;
 
-  if (this->change_mode_at_ != 0 || this->change_mode_every_ == 0) {
-    // Only read cf1 after one cycle. Apparently it's quite unstable after being changed.
-    if (this->current_mode_) {
-      float current = cf1_hz * this->current_multiplier_;
-      ESP_LOGV(TAG, "Got power=%.1fW, current=%.1fA", power, current);
-      if (this->current_sensor_ != nullptr) {
-        this->current_sensor_->publish_state(current);
-      }
-    } else {
-      float voltage = cf1_hz * this->voltage_multiplier_;
-      ESP_LOGV(TAG, "Got power=%.1fW, voltage=%.1fV", power, voltage);
-      if (this->voltage_sensor_ != nullptr) {
-        this->voltage_sensor_->publish_state(voltage);
-      }
-    }
+  if (this->adaptive_mode_switching_) {
+    this->update_adaptive_(cf1, power);
+  } else if (this->change_mode_at_ != 0 || (this->change_mode_every_ == 0 && this->sel_pin_ != nullptr)) {
+    // Only read cf1 after one cycle. Apparently it's quite unstable after being changed. A follower skips that cycle
+    // whatever its own change_mode_every, the leader switches SEL under it.
+    this->publish_cf1_(cf1, power);
   }
 
   if (this->power_sensor_ != nullptr) {
     this->power_sensor_->publish_state(power);
   }
 
+  if (this->apparent_power_sensor_ != nullptr || this->power_factor_sensor_ != nullptr) {
+    this->power_history_.add(power_uw, this->reading_time_, this->sel_switches_);
+    this->publish_apparent_power_();
+  }
+
+  // Also kept without an energy sensor, for the history checkpoints
+  this->cf_total_pulses_ += cf_pulses;
   if (this->energy_sensor_ != nullptr) {
-    cf_total_pulses_ += raw_cf;
-    float energy = cf_total_pulses_ * this->power_multiplier_ / 3600;
+    float energy = hlw8012_energy_mwh(this->cf_total_pulses_, this->power_multiplier_) / 1000.0f;
     this->energy_sensor_->publish_state(energy);
+
+    if (this->restore_energy_ && this->cf_total_pulses_ != this->saved_total_pulses_ &&
+        (this->cf_total_pulses_ - this->saved_total_pulses_ >= this->energy_save_delta_ ||
+         millis() - this->last_energy_save_ >= this->energy_save_interval_)) {
+      this->save_energy_();
+    }
   }
 
-  if (this->change_mode_every_ != 0 && this->change_mode_at_++ == this->change_mode_every_) {
-    this->current_mode_ = !this->current_mode_;
-    ESP_LOGV(TAG, "Changing mode to %s mode", this->current_mode_ ? "CURRENT" : "VOLTAGE");
-    this->change_mode_at_ = 0;
-    this->sel_pin_->digital_write(this->current_mode_);
+  if (!this->power_window_.empty()) {
+    if (this->power_min_sensor_ != nullptr)
+      this->power_min_sensor_->publish_state(this->power_window_.min() / 1000.0f);
+    if (this->power_max_sensor_ != nullptr)
+      this->power_max_sensor_->publish_state(this->power_window_.max() / 1000.0f);
+    if (this->power_mean_sensor_ != nullptr)
+      this->power_mean_sensor_->publish_state(this->power_window_.mean() / 1000.0f);
+    if (this->power_peak_sensor_ != nullptr)
+      this->power_peak_sensor_->publish_state(this->power_peak_ / 1000.0f);
+    this->power_peak_ = 0;
+  }
+
+  if (this->history_.enabled())
+    this->record_history_(power_uw);
+
+  if (this->sel_pin_ == nullptr) {
+    // SEL is switched by the leader, only count the updates since then
+    this->change_mode_at_++;
+  } else if (!this->adaptive_mode_switching_ && this->change_mode_every_ != 0 &&
+             this->change_mode_at_++ == this->change_mode_every_) {
+    this->switch_mode_();
+  }
+}
+
+void HLW8012Component::sample_() {
+  HLW8012Reading cf = this->read_cf_(this->sample_interval_ * 1000);
+  const uint64_t power_uw = cf.scale(this->power_multiplier_);
+  const uint32_t power_mw = power_uw / 1000;
+  this->power_window_.add(power_mw);
+  this->power_peak_ = std::max(this->power_peak_, power_mw);
+  this->last_sample_ = cf;
+  this->sampled_cf_.pulses += cf.pulses;
+  if (this->measurement_mode_ == HLW8012_MEASUREMENT_MODE_COUNT) {
+    // Every pulse counts towards the update, whatever the single-pulse rule made of this sample
+    this->sampled_cf_.periods += cf.pulses;
+    this->sampled_cf_.span_us += cf.span_us;
+  } else if (cf.pulses != 0 && cf.periods != 0) {
+    // The spans of successive edge periods join up, from the last edge of one sample to the last edge of the next
+    this->sampled_cf_.periods += cf.periods;
+    this->sampled_cf_.span_us += cf.span_us;
   }
 }
 
+void HLW8012Component::on_shutdown() {
+  if (this->restore_energy_ && this->energy_sensor_ != nullptr &&
+      this->cf_total_pulses_ != this->saved_total_pulses_) {
+    this->save_energy_();
+  }
+}
+
+void HLW8012Component::load_energy_() {
+  // A handful of fixed-size records, each load is a single lookup rather than a scan
+  const uint32_t hash = this->energy_sensor_->get_object_id_hash();
+  uint8_t newest = HLW8012_ENERGY_SLOTS;
+  HLW8012EnergyRecord newest_record{};
+  for (uint8_t i = 0; i < HLW8012_ENERGY_SLOTS; i++) {
+    this->energy_prefs_[i] = global_preferences->make_preference<HLW8012EnergyRecord>(hash + i, true);
+    HLW8012EnergyRecord record;
+    if (!this->energy_prefs_[i].load(&record))
+      continue;
+    // Sequence numbers are compared as a difference so they may wrap
+    if (newest == HLW8012_ENERGY_SLOTS || (int32_t) (record.sequence - newest_record.sequence) > 0) {
+      newest = i;
+      newest_record = record;
+    }
+  }
+
+  if (newest != HLW8012_ENERGY_SLOTS) {
+    this->energy_sequence_ = newest_record.sequence;
+    this->cf_total_pulses_ = newest_record.total_pulses;
+    ESP_LOGD(TAG, "Restored energy total of %" PRIu64 " pulses from slot %u", this->cf_total_pulses_, newest);
+  }
+  this->saved_total_pulses_ = this->cf_total_pulses_;
+  this->last_energy_save_ = millis();
+}
+
+void HLW8012Component::save_energy_() {
+  // Each save goes to the next slot, spreading the writes over all of them
+  this->energy_sequence_++;
+  HLW8012EnergyRecord record{this->energy_sequence_, this->cf_total_pulses_};
+  this->energy_prefs_[this->energy_sequence_ % HLW8012_ENERGY_SLOTS].save(&record);
+  this->saved_total_pulses_ = this->cf_total_pulses_;
+  this->last_energy_save_ = millis();
+  ESP_LOGV(TAG, "Saved energy total of %" PRIu64 " pulses", this->cf_total_pulses_);
+}
+
+static bool api_connected() {
+#ifdef USE_API
+  return api::global_api_server != nullptr && api::global_api_server->is_connected();
+#else
+  return true;
+#endif
+}
+
+void HLW8012Component::record_history_(uint64_t power_uw) {
+  if (!api_connected()) {
+    // Live states are lost without a client, keep them for later
+    this->history_.add(millis(), power_uw / 100000,
+                       hlw8012_energy_mwh(this->cf_total_pulses_, this->power_multiplier_));
+    return;
+  }
+  if (this->history_flushing_ || this->history_.empty())
+    return;
+  ESP_LOGD(TAG, "Connected, flushing history");
+  this->history_flushing_ = true;
+  this->set_interval("history", this->history_flush_interval_, [this]() { this->flush_history_(); });
+}
+
+void HLW8012Component::flush_history_() {
+  if (!api_connected()) {
+    // Whatever is left stays buffered, record_history_() starts flushing again on the next connection
+    ESP_LOGD(TAG, "Disconnected, history flush paused");
+    this->cancel_interval("history");
+    this->history_flushing_ = false;
+    return;
+  }
+  // Batches are spread out so a long outage does not flood the connection that just came back
+  std::vector<HLW8012HistorySample> batch;
+  batch.reserve(this->history_batch_size_);
+  const uint32_t now = millis();
+  HLW8012HistoryEntry entry;
+  while (batch.size() < this->history_batch_size_ && this->history_.pop(&entry)) {
+    batch.push_back({now - entry.time, entry.power / 10.0f, entry.checkpoint ? entry.energy / 1000.0f : NAN});
+  }
+  if (!batch.empty()) {
+    for (auto *trigger : this->history_flush_triggers_)
+      trigger->trigger(batch);
+  }
+  if (this->history_.empty()) {
+    if (this->history_.dropped() != 0)
+      ESP_LOGW(TAG, "History buffer overflowed, %" PRIu32 " readings were lost", this->history_.dropped());
+    this->cancel_interval("history");
+    this->history_flushing_ = false;
+  }
+}
+
+uint64_t HLW8012Component::publish_cf1_(const HLW8012Reading &cf1, float power) {
+  const uint64_t value = cf1.scale(this->current_mode_ ? this->current_multiplier_ : this->voltage_multiplier_);
+  (this->current_mode_ ? this->current_history_ : this->voltage_history_)
+      .add(value, this->reading_time_, this->sel_switches_);
+  if (this->current_mode_) {
+    float current = value / HLW8012_VALUE_SCALE;
+    ESP_LOGV(TAG, "Got power=%.1fW, current=%.1fA", power, current);
+    if (this->current_sensor_ != nullptr) {
+      this->current_sensor_->publish_state(current);
+    }
+  } else {
+    float voltage = value / HLW8012_VALUE_SCALE;
+    ESP_LOGV(TAG, "Got power=%.1fW, voltage=%.1fV", power, voltage);
+    if (this->voltage_sensor_ != nullptr) {
+      this->voltage_sensor_->publish_state(voltage);
+    }
+  }
+  return value;
+}
+
+void HLW8012Component::publish_apparent_power_() {
+  if (this->voltage_history_.count == 0 || this->current_history_.count == 0)
+    return;
+  // SEL only ever lets one of voltage and current be measured. Both, and power, are aligned to the older of the two
+  // latest readings: that one is exact there, the other is interpolated between its last reading before SEL switched
+  // away from it and the first one after SEL switched back.
+  const uint32_t voltage_time = this->voltage_history_.newest_time();
+  const uint32_t current_time = this->current_history_.newest_time();
+  const uint32_t time = (int32_t) (voltage_time - current_time) < 0 ? voltage_time : current_time;
+  if (millis() - time > this->max_reading_age_) {
+    ESP_LOGV(TAG, "Voltage and current readings too old to combine");
+    return;
+  }
+  uint64_t voltage_uv, current_ua;
+  if (!this->voltage_history_.at(time, &voltage_uv) || !this->current_history_.at(time, &current_ua)) {
+    ESP_LOGV(TAG, "No voltage and current readings on both sides of %" PRIu32 " ms yet", time);
+    return;
+  }
+
+  // uV * uA = pVA, to uVA
+  const uint64_t apparent_power_uva = voltage_uv * current_ua / 1000000;
+  if (this->apparent_power_sensor_ != nullptr)
+    this->apparent_power_sensor_->publish_state(apparent_power_uva / HLW8012_VALUE_SCALE);
+  uint64_t power_uw;
+  if (this->power_factor_sensor_ != nullptr && apparent_power_uva != 0 && this->power_history_.at(time, &power_uw)) {
+    // Measurement noise can push real power slightly above apparent power
+    this->power_factor_sensor_->publish_state(std::min(1.0f, (float) power_uw / apparent_power_uva));
+  }
+}
+
+void HLW8012Component::update_adaptive_(const HLW8012Reading &cf1, float power) {
+  if (this->mode_windows_ < UINT8_MAX)
+    this->mode_windows_++;
+  // Wait for a window that holds settled periods, the reference edge carries over to the next one
+  bool settled = this->cf1_edges_.settled();
+  if (settled && cf1.pulses != 0 && cf1.periods != 0) {
+    // Two agreeing periods early in the glide after SEL switched pass for settled. Once CF1 has really settled the
+    // last period matches the mean of the window, otherwise settle again from here.
+    uint32_t edge_period;
+    {
+      InterruptLock lock;
+      edge_period = this->cf1_edges_.edge_period;
+    }
+    const uint32_t mean = cf1.span_us / cf1.periods;
+    if ((edge_period > mean ? edge_period - mean : mean - edge_period) > mean / 16) {
+      this->cf1_edges_.reset(true);
+      settled = false;
+    }
+  }
+  if ((!settled || cf1.periods == 0) && this->mode_windows_ < HLW8012_ADAPTIVE_MAX_WINDOWS)
+    return;
+  if (!settled) {
+    if (!this->cf1_edges_.silent()) {
+      // CF1 still glides from the other quantity, nothing was measured. Measure the other one meanwhile.
+      this->switch_mode_();
+      return;
+    }
+    // Not a single edge since SEL switched. That is zero once the silence outlasts any period, as
+    // HLW8012PeriodTracker decides it, so wait that long.
+    if (micros() - this->cf1_edges_.reset_at <= HLW8012_MAX_PERIOD_US)
+      return;
+  }
+
+  const uint64_t value = this->publish_cf1_(settled ? cf1 : HLW8012Reading{0, 0, 1}, power);
+
+  const uint8_t mode = this->current_mode_;
+  const uint64_t last = this->cf1_last_[mode];
+  const uint64_t change = value > last ? value - last : last - value;
+  this->cf1_change_[mode] = last == 0 ? 0.0f : (float) change / last;
+  this->cf1_last_[mode] = value;
+  this->mode_readings_++;
+
+  // Bias sampling toward whichever quantity is moving faster, without starving the other one
+  if (this->mode_readings_ < HLW8012_ADAPTIVE_MAX_RUN &&
+      this->cf1_change_[mode] > HLW8012_ADAPTIVE_BIAS * this->cf1_change_[!mode]) {
+    this->mode_windows_ = 0;
+    return;
+  }
+  this->switch_mode_();
+}
+
+void HLW8012Component::switch_mode_() { this->set_mode_(!this->current_mode_); }
+
+void HLW8012Component::set_mode_(bool current_mode) {
+  this->current_mode_ = current_mode;
+  ESP_LOGV(TAG, "Changing mode to %s mode", this->current_mode_ ? "CURRENT" : "VOLTAGE");
+  this->sel_switches_++;
+  this->change_mode_at_ = 0;
+  this->mode_windows_ = 0;
+  this->mode_readings_ = 0;
+  if (this->sel_pin_ != nullptr)
+    this->sel_pin_->digital_write(this->current_mode_);
+  // Edges from before the switch belong to the other quantity
+  this->cf1_edges_.reset(this->adaptive_mode_switching_);
+  for (auto *follower : this->sel_followers_)
+    follower->set_mode_(current_mode);
+}
+
 }  // namespace esphome::hlw8012
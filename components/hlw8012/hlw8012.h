@@ -1,22 +1,85 @@
 #pragma once
 
+#include "esphome/core/automation.h"
 #include "esphome/core/component.h"
 #include "esphome/core/hal.h"
+#include "esphome/core/preferences.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/pulse_counter/pulse_counter_sensor.h"
+#include "hlw8012_measurement.h"
 
 #include <cinttypes>
+#include <vector>
 
 namespace esphome::hlw8012 {
 
 enum HLW8012InitialMode { HLW8012_INITIAL_MODE_CURRENT = 0, HLW8012_INITIAL_MODE_VOLTAGE };
 
-enum HLW8012SensorModels {
-  HLW8012_SENSOR_MODEL_HLW8012 = 0,
-  HLW8012_SENSOR_MODEL_CSE7759,
-  HLW8012_SENSOR_MODEL_BL0937
+enum HLW8012MeasurementMode { HLW8012_MEASUREMENT_MODE_COUNT = 0, HLW8012_MEASUREMENT_MODE_PERIOD };
+
+// Counts the rising edges of a CF/CF1 output in an interrupt and timestamps the first and last of each window
+struct HLW8012EdgeStore {
+  void setup(InternalGPIOPin *pin);
+  // Takes the edges of the window ending at now (in us)
+  HLW8012Reading read(uint32_t now);
+  // Forgets the reference edge, e.g. after SEL switched what CF1 measures. With settle, edges are only counted
+  // again once two consecutive periods agree.
+  void reset(bool settle);
+  bool settled() const { return !this->settling; }
+  // Settling and not a single edge since the reset, which was at reset_at (in us)
+  bool silent() const { return this->settling && this->settle_period == 0; }
+  static void gpio_intr(HLW8012EdgeStore *arg);
+
+  volatile uint32_t edges{0};
+  volatile uint32_t first_edge{0};
+  volatile uint32_t last_edge{0};
+  volatile bool settling{false};
+  volatile uint32_t settle_period{0};
+  uint32_t reset_at{0};
+  HLW8012PeriodTracker tracker;
+  // Time between the last two edges in us, only meaningful once period_edges reached 2
+  volatile uint32_t edge_period{0};
+  // Edges since the period was last forgotten, up to 2
+  volatile uint8_t period_edges{0};
+};
+
+// Number of preference slots the energy total rotates through
+static const uint8_t HLW8012_ENERGY_SLOTS = 4;
+
+// Energy total as persisted, the slot with the newest sequence number holds the current total
+struct HLW8012EnergyRecord {
+  uint32_t sequence;
+  uint64_t total_pulses;
+};
+
+// Fires once the CF period has stayed at or below the threshold for the duration, i.e. power above the threshold,
+// and re-arms once it drops back below. The threshold period is computed by codegen from the threshold power.
+class OverloadTrigger : public Trigger<float> {
+ public:
+  OverloadTrigger(uint32_t threshold_period, uint32_t duration)
+      : threshold_period_(threshold_period), duration_(duration) {}
+
+  // period in us, now in ms
+  void check(uint32_t period, float power, uint32_t now);
+
+ protected:
+  uint32_t threshold_period_;
+  uint32_t duration_;
+  uint32_t overloaded_since_{0};
+  bool tripped_{false};
 };
 
+// A reading recorded while disconnected, age in ms before the flush that reports it
+struct HLW8012HistorySample {
+  uint32_t age;
+  float power;
+  // Energy total in Wh, NAN except for the checkpoints
+  float energy;
+};
+
+// Fires with each batch of readings flushed from the history buffer, oldest first
+class HistoryFlushTrigger : public Trigger<std::vector<HLW8012HistorySample>> {};
+
 #ifdef HAS_PCNT
 #define USE_PCNT true
 #else
@@ -25,38 +88,122 @@ enum HLW8012SensorModels {
 
 class HLW8012Component final: public PollingComponent {
  public:
-  HLW8012Component()
-      : cf_store_(*pulse_counter::get_storage(USE_PCNT)), cf1_store_(*pulse_counter::get_storage(USE_PCNT)) {}
+  // Codegen decides which outputs get one of the limited hardware counters, the rest count in an interrupt
+  HLW8012Component(bool cf_pcnt, bool cf1_pcnt)
+      : cf_pcnt_(USE_PCNT && cf_pcnt),
+        cf1_pcnt_(USE_PCNT && cf1_pcnt),
+        cf_store_(*pulse_counter::get_storage(cf_pcnt_)),
+        cf1_store_(*pulse_counter::get_storage(cf1_pcnt_)) {}
 
   void setup() override;
   void dump_config() override;
   void update() override;
+  // Watches the CF period for overload triggers
+  void loop() override;
+  void on_shutdown() override;
 
   void set_initial_mode(HLW8012InitialMode initial_mode) {
     current_mode_ = initial_mode == HLW8012_INITIAL_MODE_CURRENT;
   }
-  void set_sensor_model(HLW8012SensorModels sensor_model) { sensor_model_ = sensor_model; }
+  void set_measurement_mode(HLW8012MeasurementMode measurement_mode) { measurement_mode_ = measurement_mode; }
   void set_change_mode_every(uint32_t change_mode_every) { change_mode_every_ = change_mode_every; }
-  void set_current_resistor(float current_resistor) { current_resistor_ = current_resistor; }
-  void set_voltage_divider(float voltage_divider) { voltage_divider_ = voltage_divider; }
+  // Switches SEL as soon as CF1 has settled instead of every change_mode_every updates, needs edge period mode
+  void set_adaptive_mode_switching(bool adaptive_mode_switching) {
+    adaptive_mode_switching_ = adaptive_mode_switching;
+  }
+  // Computed by codegen from the chip model, current resistor and voltage divider, in nW, nA and nV per Hz
+  void set_multipliers(uint64_t power_multiplier, uint64_t current_multiplier, uint64_t voltage_multiplier) {
+    power_multiplier_ = power_multiplier;
+    current_multiplier_ = current_multiplier;
+    voltage_multiplier_ = voltage_multiplier;
+  }
   void set_sel_pin(GPIOPin *sel_pin) { sel_pin_ = sel_pin; }
+  // For chips on a SEL line driven by another one, which then switches this chip along with itself
+  void set_sel_leader(HLW8012Component *sel_leader) { sel_leader->sel_followers_.push_back(this); }
   void set_cf_pin(InternalGPIOPin *cf_pin) { cf_pin_ = cf_pin; }
   void set_cf1_pin(InternalGPIOPin *cf1_pin) { cf1_pin_ = cf1_pin; }
   void set_voltage_sensor(sensor::Sensor *voltage_sensor) { voltage_sensor_ = voltage_sensor; }
   void set_current_sensor(sensor::Sensor *current_sensor) { current_sensor_ = current_sensor; }
   void set_power_sensor(sensor::Sensor *power_sensor) { power_sensor_ = power_sensor; }
+  void set_apparent_power_sensor(sensor::Sensor *apparent_power_sensor) {
+    apparent_power_sensor_ = apparent_power_sensor;
+  }
+  void set_power_factor_sensor(sensor::Sensor *power_factor_sensor) { power_factor_sensor_ = power_factor_sensor; }
+  // Apparent power and power factor are not published while the older of the voltage and current readings is older
+  // than this in ms
+  void set_max_reading_age(uint32_t max_reading_age) { max_reading_age_ = max_reading_age; }
   void set_energy_sensor(sensor::Sensor *energy_sensor) { energy_sensor_ = energy_sensor; }
+  void set_power_min_sensor(sensor::Sensor *power_min_sensor) { power_min_sensor_ = power_min_sensor; }
+  void set_power_max_sensor(sensor::Sensor *power_max_sensor) { power_max_sensor_ = power_max_sensor; }
+  void set_power_mean_sensor(sensor::Sensor *power_mean_sensor) { power_mean_sensor_ = power_mean_sensor; }
+  void set_power_peak_sensor(sensor::Sensor *power_peak_sensor) { power_peak_sensor_ = power_peak_sensor; }
+  // Samples CF every sample_interval ms into a window of the given size, 0 reads CF once per update
+  void set_sample_interval(uint32_t sample_interval) { sample_interval_ = sample_interval; }
+  HLW8012PowerWindow &get_power_window() { return power_window_; }
+  // Needs edge period mode
+  void add_overload_trigger(OverloadTrigger *trigger) { overload_triggers_.push_back(trigger); }
+  // The energy total is saved once it grew by energy_save_delta pulses, or after energy_save_interval ms if it grew
+  // at all
+  void set_restore_energy(bool restore_energy) { restore_energy_ = restore_energy; }
+  void set_energy_save_delta(uint64_t energy_save_delta) { energy_save_delta_ = energy_save_delta; }
+  void set_energy_save_interval(uint32_t energy_save_interval) { energy_save_interval_ = energy_save_interval; }
+  // Readings are recorded while the API has no client and flushed in batches of history_batch_size every
+  // history_flush_interval ms once one connects
+  HLW8012HistoryBuffer &get_history() { return history_; }
+  void set_history_batch_size(uint16_t history_batch_size) { history_batch_size_ = history_batch_size; }
+  void set_history_flush_interval(uint32_t history_flush_interval) {
+    history_flush_interval_ = history_flush_interval;
+  }
+  void add_history_flush_trigger(HistoryFlushTrigger *trigger) { history_flush_triggers_.push_back(trigger); }
 
  protected:
+  // window_us is the span of a pulse count reading
+  HLW8012Reading read_cf_(uint32_t window_us);
+  void sample_();
+  HLW8012Reading read_cf1_();
+  // Returns the published voltage or current in micro-units
+  uint64_t publish_cf1_(const HLW8012Reading &cf1, float power);
+  void publish_apparent_power_();
+  void update_adaptive_(const HLW8012Reading &cf1, float power);
+  void switch_mode_();
+  void set_mode_(bool current_mode);
+  void load_energy_();
+  void save_energy_();
+  void record_history_(uint64_t power_uw);
+  void flush_history_();
+
   uint32_t nth_value_{0};
   bool current_mode_{false};
   uint32_t change_mode_at_{0};
   uint32_t change_mode_every_{8};
-  float current_resistor_{0.001};
-  float voltage_divider_{2351};
-  HLW8012SensorModels sensor_model_{HLW8012_SENSOR_MODEL_HLW8012};
+  bool adaptive_mode_switching_{false};
+  // Updates since the last switch and readings published in a row, for adaptive switching
+  uint8_t mode_windows_{0};
+  uint8_t mode_readings_{0};
+  // Last value and relative change of voltage [0] and current [1]
+  uint64_t cf1_last_[2]{0, 0};
+  float cf1_change_[2]{0.0f, 0.0f};
+  HLW8012MeasurementMode measurement_mode_{HLW8012_MEASUREMENT_MODE_COUNT};
+  HLW8012EdgeStore cf_edges_;
+  HLW8012EdgeStore cf1_edges_;
   uint64_t cf_total_pulses_{0};
-  GPIOPin *sel_pin_;
+  bool restore_energy_{false};
+  uint64_t energy_save_delta_{1};
+  uint32_t energy_save_interval_{900000};
+  ESPPreferenceObject energy_prefs_[HLW8012_ENERGY_SLOTS];
+  uint32_t energy_sequence_{0};
+  uint64_t saved_total_pulses_{0};
+  uint32_t last_energy_save_{0};
+  HLW8012HistoryBuffer history_;
+  uint16_t history_batch_size_{50};
+  uint32_t history_flush_interval_{1000};
+  bool history_flushing_{false};
+  std::vector<HistoryFlushTrigger *> history_flush_triggers_;
+  // nullptr for chips following the SEL line of another
+  GPIOPin *sel_pin_{nullptr};
+  std::vector<HLW8012Component *> sel_followers_;
+  bool cf_pcnt_;
+  bool cf1_pcnt_;
   InternalGPIOPin *cf_pin_;
   pulse_counter::PulseCounterStorageBase &cf_store_;
   InternalGPIOPin *cf1_pin_;
@@ -64,11 +211,36 @@ class HLW8012Component final: public PollingComponent {
   sensor::Sensor *voltage_sensor_{nullptr};
   sensor::Sensor *current_sensor_{nullptr};
   sensor::Sensor *power_sensor_{nullptr};
+  sensor::Sensor *apparent_power_sensor_{nullptr};
+  sensor::Sensor *power_factor_sensor_{nullptr};
+  // Voltage in uV, current in uA and power in uW, each starting a new run at every SEL switch
+  HLW8012History voltage_history_{};
+  HLW8012History current_history_{};
+  HLW8012History power_history_{};
+  uint32_t max_reading_age_{600000};
+  // Time in ms of the readings of the current update
+  uint32_t reading_time_{0};
+  uint32_t sel_switches_{0};
+
+  std::vector<OverloadTrigger *> overload_triggers_;
   sensor::Sensor *energy_sensor_{nullptr};
+  sensor::Sensor *power_min_sensor_{nullptr};
+  sensor::Sensor *power_max_sensor_{nullptr};
+  sensor::Sensor *power_mean_sensor_{nullptr};
+  sensor::Sensor *power_peak_sensor_{nullptr};
+
+  uint32_t sample_interval_{0};
+  // Power samples in mW
+  HLW8012PowerWindow power_window_;
+  uint32_t power_peak_{0};
+  // CF over all samples since the last update, which publishes it as power, and the latest sample alone
+  HLW8012Reading sampled_cf_{0, 0, 0};
+  HLW8012Reading last_sample_{0, 0, 1};
 
-  float voltage_multiplier_{0.0f};
-  float current_multiplier_{0.0f};
-  float power_multiplier_{0.0f};
+  // Fixed point, in nV, nA and nW per Hz of CF1/CF, i.e. per pulse per second
+  uint64_t voltage_multiplier_{0};
+  uint64_t current_multiplier_{0};
+  uint64_t power_multiplier_{0};
 };
 
 }  // namespace esphome::hlw8012
\ No newline at end of file
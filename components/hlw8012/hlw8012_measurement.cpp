@@ -0,0 +1,229 @@
+#include "hlw8012_measurement.h"
+
+#include <algorithm>
+
+namespace esphome::hlw8012 {
+
+HLW8012Reading HLW8012PeriodTracker::take(uint32_t edges, uint32_t first_edge, uint32_t last_edge, uint32_t now) {
+  if (edges == 0) {
+    const uint32_t elapsed = now - this->reference_edge_;
+    if (!this->has_reference_ || elapsed > HLW8012_MAX_PERIOD_US) {
+      this->has_reference_ = false;
+      return {0, 0, 1};
+    }
+    // No edge this window, the current period is at least as long as the time since the last edge
+    return {0, 1, std::max(elapsed, this->last_period_)};
+  }
+
+  HLW8012Reading reading{edges, 0, 1};
+  if (this->has_reference_) {
+    reading.periods = edges;
+    reading.span_us = last_edge - this->reference_edge_;
+  } else if (edges >= 2) {
+    reading.periods = edges - 1;
+    reading.span_us = last_edge - first_edge;
+  }
+  // At high rates this degenerates into counting over (nearly) the whole window, at low rates it is a period
+  // measurement between edges that may lie several windows apart
+  if (reading.periods)
+    this->last_period_ = reading.span_us / reading.periods;
+  this->reference_edge_ = last_edge;
+  this->has_reference_ = true;
+  return reading;
+}
+
+uint64_t HLW8012Reading::scale(uint64_t multiplier) const {
+  // periods * 1000 * multiplier / span_us, split like hlw8012_energy_mwh(). An hour of pulses at a few kW already
+  // overflows the plain product, the split keeps every partial product below 2^64.
+  const uint64_t divisor = this->span_us;
+  const uint64_t scaled_periods = (uint64_t) this->periods * 1000;
+  const uint64_t periods_whole = scaled_periods / divisor, periods_rest = scaled_periods % divisor;
+  const uint64_t multiplier_whole = multiplier / divisor, multiplier_rest = multiplier % divisor;
+  return periods_whole * multiplier + periods_rest * multiplier_whole + periods_rest * multiplier_rest / divisor;
+}
+
+uint64_t hlw8012_energy_mwh(uint64_t pulses, uint64_t multiplier) {
+  // pulses * multiplier / HLW8012_NWS_PER_MWH, split so no partial product overflows and the result stays exact
+  const uint64_t divisor = HLW8012_NWS_PER_MWH;
+  const uint64_t pulses_whole = pulses / divisor, pulses_rest = pulses % divisor;
+  const uint64_t multiplier_whole = multiplier / divisor, multiplier_rest = multiplier % divisor;
+  return pulses_whole * multiplier + pulses_rest * multiplier_whole + pulses_rest * multiplier_rest / divisor;
+}
+
+void HLW8012History::add(uint64_t value, uint32_t time, uint32_t run) {
+  const bool same_run = this->count != 0 && run == this->run;
+  if (!same_run || !this->run_extended) {
+    if (this->count == HLW8012_HISTORY_SIZE) {
+      for (uint8_t i = 1; i < HLW8012_HISTORY_SIZE; i++) {
+        this->value[i - 1] = this->value[i];
+        this->time[i - 1] = this->time[i];
+      }
+    } else {
+      this->count++;
+    }
+  }
+  // Otherwise the newest entry is the latest reading of this run so far and gets replaced
+  this->value[this->count - 1] = value;
+  this->time[this->count - 1] = time;
+  this->run = run;
+  this->run_extended = same_run;
+}
+
+bool HLW8012History::at(uint32_t time, uint64_t *value) const {
+  // The newest entry at or before time, and the one after it
+  for (uint8_t i = this->count; i-- > 0;) {
+    const uint32_t offset = time - this->time[i];
+    if ((int32_t) offset < 0)
+      continue;
+    if (offset == 0) {
+      *value = this->value[i];
+      return true;
+    }
+    if (i + 1 == this->count)
+      return false;
+    const uint32_t span = this->time[i + 1] - this->time[i];
+    const int64_t delta = (int64_t) this->value[i + 1] - (int64_t) this->value[i];
+    *value = this->value[i] + delta * (int64_t) offset / (int64_t) span;
+    return true;
+  }
+  return false;
+}
+
+void HLW8012PowerWindow::add(uint32_t sample) {
+  const uint32_t number = this->next_++;
+  const uint32_t slot = number % this->size_;
+  if (this->filled_ == this->size_) {
+    this->sum_ -= this->samples_[slot];
+  } else {
+    this->filled_++;
+  }
+  this->samples_[slot] = sample;
+  this->sum_ += sample;
+
+  this->push_(this->min_deque_, number, [sample](uint32_t other) { return other >= sample; });
+  this->push_(this->max_deque_, number, [sample](uint32_t other) { return other <= sample; });
+}
+
+template<typename Supersedes>
+void HLW8012PowerWindow::push_(Deque &deque, uint32_t number, Supersedes supersedes) {
+  // One sample enters per call, so at most the front one has left the window
+  if (deque.length != 0 && number - deque.front() >= this->size_) {
+    deque.head = (deque.head + 1) % this->size_;
+    deque.length--;
+  }
+  while (deque.length != 0 &&
+         supersedes(this->samples_[deque.items[(deque.head + deque.length - 1) % this->size_] % this->size_]))
+    deque.length--;
+  deque.items[(deque.head + deque.length) % this->size_] = number;
+  deque.length++;
+}
+
+// Block header: time, power and energy of the checkpoint, little endian, then the number of readings in the block
+static const size_t HLW8012_HISTORY_HEADER_SIZE = 17;
+static const size_t HLW8012_HISTORY_COUNT_OFFSET = 16;
+
+static void history_put(uint8_t *bytes, uint64_t value, uint8_t width) {
+  for (uint8_t i = 0; i < width; i++)
+    bytes[i] = value >> (8 * i);
+}
+
+static uint64_t history_get(const uint8_t *bytes, uint8_t width) {
+  uint64_t value = 0;
+  for (uint8_t i = 0; i < width; i++)
+    value |= (uint64_t) bytes[i] << (8 * i);
+  return value;
+}
+
+// Zigzag maps small changes of either sign to small varints
+static size_t history_put_change(uint8_t *bytes, int32_t change) {
+  uint32_t value = ((uint32_t) change << 1) ^ (uint32_t) (change >> 31);
+  size_t len = 0;
+  while (value >= 0x80) {
+    bytes[len++] = value | 0x80;
+    value >>= 7;
+  }
+  bytes[len++] = value;
+  return len;
+}
+
+static int32_t history_get_change(const uint8_t *bytes, size_t *offset) {
+  uint32_t value = 0;
+  for (uint8_t shift = 0;; shift += 7) {
+    const uint8_t byte = bytes[(*offset)++];
+    value |= (uint32_t) (byte & 0x7F) << shift;
+    if (!(byte & 0x80))
+      break;
+  }
+  return (int32_t) (value >> 1) ^ -(int32_t) (value & 1);
+}
+
+void HLW8012HistoryBuffer::add(uint32_t time, uint32_t power, uint64_t energy) {
+  if (this->num_blocks_ == 0)
+    return;
+  if (this->blocks_ != 0) {
+    uint8_t *block = this->block_((this->first_ + this->blocks_ - 1) % this->num_blocks_);
+    const uint32_t interval = time - this->write_time_;
+    // At most two 5 byte varints
+    uint8_t change[10];
+    size_t len = history_put_change(change, interval - this->write_interval_);
+    len += history_put_change(change + len, power - this->write_power_);
+    if (block[HLW8012_HISTORY_COUNT_OFFSET] != UINT8_MAX && this->write_offset_ + len <= HLW8012_HISTORY_BLOCK_SIZE) {
+      std::copy(change, change + len, block + this->write_offset_);
+      this->write_offset_ += len;
+      block[HLW8012_HISTORY_COUNT_OFFSET]++;
+      this->write_time_ = time;
+      this->write_interval_ = interval;
+      this->write_power_ = power;
+      return;
+    }
+  }
+
+  // Start a new block with a checkpoint
+  if (this->blocks_ == this->num_blocks_)
+    this->drop_oldest_();
+  uint8_t *block = this->block_((this->first_ + this->blocks_) % this->num_blocks_);
+  this->blocks_++;
+  history_put(block, time, 4);
+  history_put(block + 4, power, 4);
+  history_put(block + 8, energy, 8);
+  block[HLW8012_HISTORY_COUNT_OFFSET] = 1;
+  this->write_offset_ = HLW8012_HISTORY_HEADER_SIZE;
+  this->write_time_ = time;
+  this->write_interval_ = 0;
+  this->write_power_ = power;
+}
+
+void HLW8012HistoryBuffer::drop_oldest_() {
+  this->dropped_ += this->block_(this->first_)[HLW8012_HISTORY_COUNT_OFFSET] - this->read_index_;
+  this->first_ = (this->first_ + 1) % this->num_blocks_;
+  this->blocks_--;
+  this->read_index_ = 0;
+}
+
+bool HLW8012HistoryBuffer::pop(HLW8012HistoryEntry *entry) {
+  if (this->empty())
+    return false;
+  const uint8_t *block = this->block_(this->first_);
+  if (this->read_index_ == block[HLW8012_HISTORY_COUNT_OFFSET]) {
+    // Fully read and no longer written to, the readings were counted when they were taken
+    this->drop_oldest_();
+    block = this->block_(this->first_);
+  }
+
+  if (this->read_index_ == 0) {
+    this->read_time_ = history_get(block, 4);
+    this->read_power_ = history_get(block + 4, 4);
+    this->read_interval_ = 0;
+    this->read_offset_ = HLW8012_HISTORY_HEADER_SIZE;
+    *entry = {this->read_time_, this->read_power_, history_get(block + 8, 8), true};
+  } else {
+    this->read_interval_ += history_get_change(block, &this->read_offset_);
+    this->read_time_ += this->read_interval_;
+    this->read_power_ += history_get_change(block, &this->read_offset_);
+    *entry = {this->read_time_, this->read_power_, 0, false};
+  }
+  this->read_index_++;
+  return true;
+}
+
+}  // namespace esphome::hlw8012
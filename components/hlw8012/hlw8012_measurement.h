@@ -0,0 +1,159 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Measurement math of the HLW8012 family: turning edge counts and timestamps into frequencies, scaling them with the
+// fixed-point multipliers, energy and the aggregates over readings. Edges and times are passed in rather than read
+// here; tests/host/hlw8012_simulator.cpp drives it, through the component, with pulse trains of scripted loads.
+
+namespace esphome::hlw8012 {
+
+// Without an edge for this long the output is considered stopped, 0.1 Hz is well below any usable reading
+static const uint32_t HLW8012_MAX_PERIOD_US = 10000000;
+// nW·s per nano-unit multiplier to mWh
+static const uint64_t HLW8012_NWS_PER_MWH = 3600000000ULL;
+
+// Pulses seen in one update window. The frequency is periods / span, which for pulse counting is simply the
+// pulse count over the update interval.
+struct HLW8012Reading {
+  // New pulses since the last reading, for energy accumulation
+  uint32_t pulses;
+  uint32_t periods;
+  // At most the 1 h codegen allows for update_interval and sample_interval
+  uint32_t span_us;
+
+  // Scales the frequency by a multiplier in nano-units per Hz, giving micro-units, exact for any span and multiplier
+  uint64_t scale(uint64_t multiplier) const;
+};
+
+// Turns the edges of successive windows into readings. Periods are measured from the last edge of an earlier
+// window, so a single edge per window is enough.
+class HLW8012PeriodTracker {
+ public:
+  // edges counted in the window ending at now, with the time of the first and last of them, all times in us
+  HLW8012Reading take(uint32_t edges, uint32_t first_edge, uint32_t last_edge, uint32_t now);
+  void reset() { *this = {}; }
+
+ protected:
+  uint32_t reference_edge_{0};
+  bool has_reference_{false};
+  uint32_t last_period_{0};
+};
+
+// Energy in mWh of a pulse total, exact for any total
+uint64_t hlw8012_energy_mwh(uint64_t pulses, uint64_t multiplier);
+
+// Entries per HLW8012History: the first and last reading of the current run and of the one before it
+static const uint8_t HLW8012_HISTORY_SIZE = 4;
+
+// Readings of a quantity with their time in ms, for aligning it with readings taken at other times. A run is the
+// readings between two SEL switches, only its first and latest reading are kept. That way the last reading before CF1
+// switched away from the quantity and the first one after it switched back both survive a run of any length.
+struct HLW8012History {
+  uint64_t value[HLW8012_HISTORY_SIZE];
+  uint32_t time[HLW8012_HISTORY_SIZE];
+  // Entries in use, oldest first
+  uint8_t count;
+  // Run of the newest entry and whether it is a later reading of that run rather than its first
+  uint32_t run;
+  bool run_extended;
+
+  // run changes with every SEL switch
+  void add(uint64_t value, uint32_t time, uint32_t run);
+  uint32_t newest_time() const { return this->time[this->count - 1]; }
+  // Linear interpolation between the two entries on either side of time. Returns false if time is outside them.
+  bool at(uint32_t time, uint64_t *value) const;
+};
+
+// Sliding window over the last size power samples. Min and max are kept in monotonic deques of sample numbers and
+// the mean as a running sum, so adding a sample is O(1) amortised. Storage is allocated by codegen.
+class HLW8012PowerWindow {
+ public:
+  void set_storage(uint32_t *samples, uint32_t *min_deque, uint32_t *max_deque, uint32_t size) {
+    samples_ = samples;
+    min_deque_.items = min_deque;
+    max_deque_.items = max_deque;
+    size_ = size;
+  }
+  void add(uint32_t sample);
+  bool empty() const { return filled_ == 0; }
+  uint32_t min() const { return samples_[min_deque_.front() % size_]; }
+  uint32_t max() const { return samples_[max_deque_.front() % size_]; }
+  uint32_t mean() const { return sum_ / filled_; }
+
+ protected:
+  struct Deque {
+    uint32_t *items;
+    uint32_t head;
+    uint32_t length;
+    uint32_t front() const { return items[head]; }
+  };
+  // Drops samples from the back that the new one supersedes, then appends it and expires the front
+  template<typename Supersedes> void push_(Deque &deque, uint32_t number, Supersedes supersedes);
+
+  uint32_t *samples_{nullptr};
+  uint32_t size_{0};
+  Deque min_deque_{};
+  Deque max_deque_{};
+  // Sample number of the next sample, its slot is number % size_
+  uint32_t next_{0};
+  uint32_t filled_{0};
+  uint64_t sum_{0};
+};
+
+// A reading kept by HLW8012HistoryBuffer, time in ms, power in dW and energy in mWh
+struct HLW8012HistoryEntry {
+  uint32_t time;
+  uint32_t power;
+  uint64_t energy;
+  // Only checkpoints, the first entry of each block, carry the energy total
+  bool checkpoint;
+};
+
+// Bytes per block of the history buffer, the header takes 17 of them
+static const size_t HLW8012_HISTORY_BLOCK_SIZE = 64;
+
+// Readings in fixed-size blocks, each starting with a checkpoint of absolute values followed by the later readings as
+// zigzag varints: the change in the time between readings and the change in power. At a steady update interval and
+// load those are a byte each. Once full, the oldest block is dropped whole, so every remaining block still
+// decodes on its own. Storage is allocated by codegen.
+class HLW8012HistoryBuffer {
+ public:
+  void set_storage(uint8_t *storage, size_t num_blocks) {
+    storage_ = storage;
+    num_blocks_ = num_blocks;
+  }
+  bool enabled() const { return num_blocks_ != 0; }
+  bool empty() const { return blocks_ == 0 || (blocks_ == 1 && read_index_ == block_(first_)[16]); }
+  // Readings lost because the buffer was full
+  uint32_t dropped() const { return dropped_; }
+
+  void add(uint32_t time, uint32_t power, uint64_t energy);
+  // Takes the oldest reading, returns false if there is none
+  bool pop(HLW8012HistoryEntry *entry);
+
+ protected:
+  uint8_t *block_(size_t index) const { return storage_ + index * HLW8012_HISTORY_BLOCK_SIZE; }
+  void drop_oldest_();
+
+  uint8_t *storage_{nullptr};
+  size_t num_blocks_{0};
+  // Oldest block and the number of blocks in use, readings are added to the newest one
+  size_t first_{0};
+  size_t blocks_{0};
+  uint32_t dropped_{0};
+  // Where the next reading goes and the last reading it is encoded against
+  size_t write_offset_{0};
+  uint32_t write_time_{0};
+  uint32_t write_interval_{0};
+  uint32_t write_power_{0};
+  // Readings taken from the oldest block, where the next one starts and the last one taken
+  uint8_t read_index_{0};
+  size_t read_offset_{0};
+  uint32_t read_time_{0};
+  uint32_t read_interval_{0};
+  uint32_t read_power_{0};
+};
+
+}  // namespace esphome::hlw8012
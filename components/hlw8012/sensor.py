@@ -1,28 +1,52 @@
-from esphome import pins
+from esphome import automation, pins
 import esphome.codegen as cg
 from esphome.components import sensor
-from esphome.components.esp32 import include_builtin_idf_component
+from esphome.components.esp32 import (
+    get_esp32_variant,
+    include_builtin_idf_component,
+)
+from esphome.components.esp32.const import (
+    VARIANT_ESP32,
+    VARIANT_ESP32C6,
+    VARIANT_ESP32H2,
+    VARIANT_ESP32P4,
+    VARIANT_ESP32S2,
+    VARIANT_ESP32S3,
+)
 import esphome.config_validation as cv
+import esphome.final_validate as fv
 from esphome.const import (
+    CONF_APPARENT_POWER,
     CONF_CHANGE_MODE_EVERY,
     CONF_CURRENT,
     CONF_CURRENT_RESISTOR,
+    CONF_DURATION,
     CONF_ENERGY,
     CONF_ID,
     CONF_INITIAL_MODE,
     CONF_MODEL,
     CONF_POWER,
+    CONF_POWER_FACTOR,
+    CONF_RESTORE,
+    CONF_PLATFORM,
     CONF_SEL_PIN,
+    CONF_SENSOR,
+    CONF_THRESHOLD,
+    CONF_TRIGGER_ID,
+    CONF_UPDATE_INTERVAL,
     CONF_VOLTAGE,
     CONF_VOLTAGE_DIVIDER,
+    DEVICE_CLASS_APPARENT_POWER,
     DEVICE_CLASS_CURRENT,
     DEVICE_CLASS_ENERGY,
     DEVICE_CLASS_POWER,
+    DEVICE_CLASS_POWER_FACTOR,
     DEVICE_CLASS_VOLTAGE,
     STATE_CLASS_MEASUREMENT,
     STATE_CLASS_TOTAL_INCREASING,
     UNIT_AMPERE,
     UNIT_VOLT,
+    UNIT_VOLT_AMPS,
     UNIT_WATT,
     UNIT_WATT_HOURS,
 )
@@ -33,25 +57,109 @@ AUTO_LOAD = ["pulse_counter"]
 hlw8012_ns = cg.esphome_ns.namespace("hlw8012")
 HLW8012Component = hlw8012_ns.class_("HLW8012Component", cg.PollingComponent)
 HLW8012InitialMode = hlw8012_ns.enum("HLW8012InitialMode")
-HLW8012SensorModels = hlw8012_ns.enum("HLW8012SensorModels")
+HLW8012MeasurementMode = hlw8012_ns.enum("HLW8012MeasurementMode")
+OverloadTrigger = hlw8012_ns.class_(
+    "OverloadTrigger", automation.Trigger.template(cg.float_)
+)
+HLW8012HistorySample = hlw8012_ns.struct("HLW8012HistorySample")
+HistoryFlushTrigger = hlw8012_ns.class_(
+    "HistoryFlushTrigger",
+    automation.Trigger.template(cg.std_vector.template(HLW8012HistorySample)),
+)
 
 INITIAL_MODES = {
     CONF_CURRENT: HLW8012InitialMode.HLW8012_INITIAL_MODE_CURRENT,
     CONF_VOLTAGE: HLW8012InitialMode.HLW8012_INITIAL_MODE_VOLTAGE,
 }
 
+# valid for HLW8012 and CSE7759
+HLW8012_CLOCK_FREQUENCY = 3579000
+
+
+def hlw8012_multipliers(current_resistor, voltage_divider):
+    reference_voltage = 2.43
+    power = reference_voltage**2 * voltage_divider / current_resistor * 64 / 24
+    current = reference_voltage / current_resistor * 512 / 24
+    voltage = reference_voltage * voltage_divider * 256
+    return (
+        power / HLW8012_CLOCK_FREQUENCY,
+        current / HLW8012_CLOCK_FREQUENCY,
+        voltage / HLW8012_CLOCK_FREQUENCY,
+    )
+
+
+def bl0937_multipliers(current_resistor, voltage_divider):
+    reference_voltage = 1.218
+    return (
+        reference_voltage**2 * voltage_divider / current_resistor / 4596355,
+        reference_voltage / current_resistor / 222170,
+        reference_voltage * voltage_divider / 39576,
+    )
+
+
+# Power, current and voltage per Hz of CF/CF1 for each chip. They are folded into constants here so
+# the firmware carries no model specific code.
 MODELS = {
-    "HLW8012": HLW8012SensorModels.HLW8012_SENSOR_MODEL_HLW8012,
-    "CSE7759": HLW8012SensorModels.HLW8012_SENSOR_MODEL_CSE7759,
-    "BL0937": HLW8012SensorModels.HLW8012_SENSOR_MODEL_BL0937,
+    "HLW8012": hlw8012_multipliers,
+    "CSE7759": hlw8012_multipliers,
+    "BL0937": bl0937_multipliers,
+}
+
+# Pulse counting resolves one pulse per update interval, which is coarse at low load. Edge period
+# timestamps every edge in an interrupt and measures the period instead, at the cost of hardware counting.
+MEASUREMENT_MODES = {
+    "pulse_count": HLW8012MeasurementMode.HLW8012_MEASUREMENT_MODE_COUNT,
+    "edge_period": HLW8012MeasurementMode.HLW8012_MEASUREMENT_MODE_PERIOD,
 }
 
 CONF_CF1_PIN = "cf1_pin"
 CONF_CF_PIN = "cf_pin"
+CONF_MEASUREMENT_MODE = "measurement_mode"
+CONF_ENERGY_SAVE_DELTA = "energy_save_delta"
+CONF_ENERGY_SAVE_INTERVAL = "energy_save_interval"
+CONF_POWER_MIN = "power_min"
+CONF_POWER_MAX = "power_max"
+CONF_POWER_MEAN = "power_mean"
+CONF_POWER_PEAK = "power_peak"
+CONF_SAMPLE_INTERVAL = "sample_interval"
+CONF_SAMPLE_WINDOW = "sample_window"
+CONF_MAX_READING_AGE = "max_reading_age"
+CONF_ON_OVERLOAD = "on_overload"
+CONF_HISTORY = "history"
+CONF_BUFFER_SIZE = "buffer_size"
+CONF_BATCH_SIZE = "batch_size"
+CONF_FLUSH_INTERVAL = "flush_interval"
+CONF_ON_FLUSH = "on_flush"
+CONF_SEL_LEADER = "sel_leader"
+CONF_USE_PCNT = "use_pcnt"
+
+# Hardware pulse counter units per variant, the ones not listed have none
+PCNT_UNITS = {
+    VARIANT_ESP32: 8,
+    VARIANT_ESP32C6: 4,
+    VARIANT_ESP32H2: 4,
+    VARIANT_ESP32P4: 4,
+    VARIANT_ESP32S2: 4,
+    VARIANT_ESP32S3: 4,
+}
+
+# Readings span at most this long so their span in us fits a uint32, which wraps after 71.6 min
+MAX_READING_SPAN = cv.TimePeriod(hours=1)
+
+# Bytes per history block, must match HLW8012_HISTORY_BLOCK_SIZE
+HISTORY_BLOCK_SIZE = 64
+
+# Aggregates of the power samples taken every sample_interval: min, max and mean over the last
+# sample_window, and the peak since the previous update
+POWER_AGGREGATES = [CONF_POWER_MIN, CONF_POWER_MAX, CONF_POWER_MEAN, CONF_POWER_PEAK]
+
 CONFIG_SCHEMA = cv.Schema(
     {
         cv.GenerateID(): cv.declare_id(HLW8012Component),
-        cv.Required(CONF_SEL_PIN): pins.gpio_output_pin_schema,
+        # Chips sharing one SEL line: one of them drives it, the others name it as sel_leader and
+        # switch with it, ignoring their own change_mode_every
+        cv.Exclusive(CONF_SEL_PIN, "sel"): pins.gpio_output_pin_schema,
+        cv.Exclusive(CONF_SEL_LEADER, "sel"): cv.use_id(HLW8012Component),
         cv.Required(CONF_CF_PIN): cv.All(pins.internal_gpio_input_pullup_pin_schema),
         cv.Required(CONF_CF1_PIN): cv.All(pins.internal_gpio_input_pullup_pin_schema),
         cv.Optional(CONF_VOLTAGE): sensor.sensor_schema(
@@ -77,30 +185,229 @@ CONFIG_SCHEMA = cv.Schema(
             accuracy_decimals=1,
             device_class=DEVICE_CLASS_ENERGY,
             state_class=STATE_CLASS_TOTAL_INCREASING,
+        ).extend(
+            {
+                # Saves are batched, writing every update would wear out the flash within months
+                cv.Optional(CONF_RESTORE, default=True): cv.boolean,
+                cv.Optional(CONF_ENERGY_SAVE_DELTA, default=10.0): cv.positive_float,
+                cv.Optional(
+                    CONF_ENERGY_SAVE_INTERVAL, default="15min"
+                ): cv.positive_time_period_milliseconds,
+            }
+        ),
+        cv.Optional(CONF_APPARENT_POWER): sensor.sensor_schema(
+            unit_of_measurement=UNIT_VOLT_AMPS,
+            accuracy_decimals=1,
+            device_class=DEVICE_CLASS_APPARENT_POWER,
+            state_class=STATE_CLASS_MEASUREMENT,
+        ),
+        cv.Optional(CONF_POWER_FACTOR): sensor.sensor_schema(
+            accuracy_decimals=2,
+            device_class=DEVICE_CLASS_POWER_FACTOR,
+            state_class=STATE_CLASS_MEASUREMENT,
+        ),
+        # Voltage and current are measured at different times, they are only combined while neither
+        # reading is older than this
+        cv.Optional(
+            CONF_MAX_READING_AGE, default="10min"
+        ): cv.positive_time_period_milliseconds,
+        **{
+            cv.Optional(key): sensor.sensor_schema(
+                unit_of_measurement=UNIT_WATT,
+                accuracy_decimals=1,
+                device_class=DEVICE_CLASS_POWER,
+                state_class=STATE_CLASS_MEASUREMENT,
+            )
+            for key in POWER_AGGREGATES
+        },
+        cv.Optional(CONF_SAMPLE_INTERVAL, default="1s"): cv.All(
+            cv.positive_time_period_milliseconds,
+            cv.Range(min=cv.TimePeriod(milliseconds=100), max=MAX_READING_SPAN),
+        ),
+        cv.Optional(
+            CONF_SAMPLE_WINDOW, default="60s"
+        ): cv.positive_time_period_milliseconds,
+        # Checked every loop() from the CF edge period rather than at update_interval
+        cv.Optional(CONF_ON_OVERLOAD): automation.validate_automation(
+            {
+                cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(OverloadTrigger),
+                # Converted to a CF period by dividing by it
+                cv.Required(CONF_THRESHOLD): cv.All(
+                    cv.power, cv.Range(min=0, min_included=False)
+                ),
+                cv.Optional(
+                    CONF_DURATION, default="100ms"
+                ): cv.positive_time_period_milliseconds,
+            }
+        ),
+        # Readings taken while no API client is connected, handed to on_flush in batches once one is.
+        # At a steady update interval and load a reading takes about 3 bytes.
+        cv.Optional(CONF_HISTORY): cv.All(
+            cv.Schema(
+                {
+                    cv.Optional(CONF_BUFFER_SIZE, default=2048): cv.int_range(
+                        min=2 * HISTORY_BLOCK_SIZE, max=65536
+                    ),
+                    cv.Optional(CONF_BATCH_SIZE, default=50): cv.int_range(
+                        min=1, max=1000
+                    ),
+                    cv.Optional(
+                        CONF_FLUSH_INTERVAL, default="1s"
+                    ): cv.positive_time_period_milliseconds,
+                    cv.Required(CONF_ON_FLUSH): automation.validate_automation(
+                        {
+                            cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(
+                                HistoryFlushTrigger
+                            ),
+                        }
+                    ),
+                }
+            ),
+            cv.requires_component("api"),
         ),
         cv.Optional(CONF_CURRENT_RESISTOR, default=0.001): cv.resistance,
         cv.Optional(CONF_VOLTAGE_DIVIDER, default=2351): cv.positive_float,
-        cv.Optional(CONF_MODEL, default="HLW8012"): cv.enum(MODELS, upper=True),
+        cv.Optional(CONF_MODEL, default="HLW8012"): cv.one_of(*MODELS, upper=True),
         cv.Optional(CONF_CHANGE_MODE_EVERY, default=8): cv.Any(
             "never",
+            "adaptive",
             cv.All(cv.uint32_t, cv.Range(min=1)),
         ),
         cv.Optional(CONF_INITIAL_MODE, default=CONF_VOLTAGE): cv.one_of(
             *INITIAL_MODES, lower=True
         ),
+        cv.Optional(CONF_MEASUREMENT_MODE, default="pulse_count"): cv.enum(
+            MEASUREMENT_MODES, lower=True
+        ),
     }
 ).extend(cv.polling_component_schema("60s"))
 
 
+def validate_edge_period_mode(config):
+    # Settle detection and overload triggers need the timestamp of every edge
+    if config[CONF_MEASUREMENT_MODE] == "edge_period":
+        return config
+    if config[CONF_CHANGE_MODE_EVERY] == "adaptive":
+        raise cv.Invalid(
+            f"'{CONF_CHANGE_MODE_EVERY}: adaptive' requires '{CONF_MEASUREMENT_MODE}: edge_period'"
+        )
+    if CONF_ON_OVERLOAD in config:
+        raise cv.Invalid(
+            f"'{CONF_ON_OVERLOAD}' requires '{CONF_MEASUREMENT_MODE}: edge_period'"
+        )
+    return config
+
+
+def validate_update_interval(config):
+    if config[CONF_UPDATE_INTERVAL] > MAX_READING_SPAN:
+        raise cv.Invalid(
+            f"'{CONF_UPDATE_INTERVAL}' must be at most {MAX_READING_SPAN}, a reading spans one update"
+        )
+    return config
+
+
+def validate_sel(config):
+    if CONF_SEL_PIN not in config and CONF_SEL_LEADER not in config:
+        raise cv.Invalid(
+            f"Either '{CONF_SEL_PIN}' or '{CONF_SEL_LEADER}' is required"
+        )
+    if CONF_SEL_LEADER in config and config[CONF_CHANGE_MODE_EVERY] == "adaptive":
+        raise cv.Invalid(
+            f"'{CONF_CHANGE_MODE_EVERY}: adaptive' requires '{CONF_SEL_PIN}'"
+        )
+    return config
+
+
+def final_validate_sel_leader(config):
+    # The leader would switch SEL on its own settle detection, which knows nothing about the CF1 of its followers
+    if CONF_SEL_LEADER not in config:
+        return config
+    for conf in fv.full_config.get().get(CONF_SENSOR, []):
+        if (
+            conf[CONF_PLATFORM] == "hlw8012"
+            and conf[CONF_ID].id == config[CONF_SEL_LEADER].id
+            and conf[CONF_CHANGE_MODE_EVERY] == "adaptive"
+        ):
+            raise cv.Invalid(
+                f"'{CONF_SEL_LEADER}' must not use '{CONF_CHANGE_MODE_EVERY}: adaptive'",
+                path=[CONF_SEL_LEADER],
+            )
+    return config
+
+
+FINAL_VALIDATE_SCHEMA = final_validate_sel_leader
+
+
+def sample_window_size(config):
+    window = config[CONF_SAMPLE_WINDOW].total_milliseconds
+    return window // config[CONF_SAMPLE_INTERVAL].total_milliseconds
+
+
+def validate_sample_window(config):
+    if not 1 <= sample_window_size(config) <= 3600:
+        raise cv.Invalid(
+            f"'{CONF_SAMPLE_WINDOW}' must hold between 1 and 3600 samples "
+            f"of '{CONF_SAMPLE_INTERVAL}'"
+        )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(
+    CONFIG_SCHEMA,
+    validate_edge_period_mode,
+    validate_update_interval,
+    validate_sample_window,
+    validate_sel,
+)
+
+
+def allocate_pcnt():
+    """Shares the hardware pulse counters between all chips counting pulses.
+
+    CF of every chip is served first since it feeds the energy total, CF1 gets what is
+    left. Everything else counts in an interrupt. Returns {id: (cf_pcnt, cf1_pcnt)}.
+    """
+    if "hlw8012_pcnt" in CORE.data:
+        return CORE.data["hlw8012_pcnt"]
+    sensors = CORE.config.get(CONF_SENSOR, [])
+    free = PCNT_UNITS.get(get_esp32_variant(), 0) if CORE.is_esp32 else 0
+    free -= sum(
+        1
+        for conf in sensors
+        if conf[CONF_PLATFORM] == "pulse_counter" and conf.get(CONF_USE_PCNT, True)
+    )
+    chips = [
+        conf[CONF_ID].id
+        for conf in sensors
+        if conf[CONF_PLATFORM] == "hlw8012"
+        and conf[CONF_MEASUREMENT_MODE] == "pulse_count"
+    ]
+    allocation = {}
+    for chip in chips:
+        allocation[chip] = [free > 0, False]
+        free -= 1
+    for chip in chips:
+        allocation[chip][1] = free > 0
+        free -= 1
+    CORE.data["hlw8012_pcnt"] = allocation
+    return allocation
+
+
+
 async def to_code(config):
     if CORE.is_esp32:
         include_builtin_idf_component("esp_driver_pcnt")
 
-    var = cg.new_Pvariable(config[CONF_ID])
+    cf_pcnt, cf1_pcnt = allocate_pcnt().get(config[CONF_ID].id, (False, False))
+    var = cg.new_Pvariable(config[CONF_ID], cf_pcnt, cf1_pcnt)
     await cg.register_component(var, config)
 
-    sel = await cg.gpio_pin_expression(config[CONF_SEL_PIN])
-    cg.add(var.set_sel_pin(sel))
+    if CONF_SEL_PIN in config:
+        sel = await cg.gpio_pin_expression(config[CONF_SEL_PIN])
+        cg.add(var.set_sel_pin(sel))
+    else:
+        leader = await cg.get_variable(config[CONF_SEL_LEADER])
+        cg.add(var.set_sel_leader(leader))
     cf = await cg.gpio_pin_expression(config[CONF_CF_PIN])
     cg.add(var.set_cf_pin(cf))
     cf1 = await cg.gpio_pin_expression(config[CONF_CF1_PIN])
@@ -115,15 +422,85 @@ async def to_code(config):
     if CONF_POWER in config:
         sens = await sensor.new_sensor(config[CONF_POWER])
         cg.add(var.set_power_sensor(sens))
+    if CONF_APPARENT_POWER in config:
+        sens = await sensor.new_sensor(config[CONF_APPARENT_POWER])
+        cg.add(var.set_apparent_power_sensor(sens))
+    if CONF_POWER_FACTOR in config:
+        sens = await sensor.new_sensor(config[CONF_POWER_FACTOR])
+        cg.add(var.set_power_factor_sensor(sens))
+    cg.add(var.set_max_reading_age(config[CONF_MAX_READING_AGE]))
+    if any(key in config for key in POWER_AGGREGATES):
+        for key in POWER_AGGREGATES:
+            if key in config:
+                sens = await sensor.new_sensor(config[key])
+                cg.add(getattr(var, f"set_{key}_sensor")(sens))
+        cg.add(var.set_sample_interval(config[CONF_SAMPLE_INTERVAL]))
+        # Sample ring and the index deques for min and max, sized for the window
+        size = sample_window_size(config)
+        storage = [f"{config[CONF_ID]}_power_{name}" for name in ("samples", "min", "max")]
+        for name in storage:
+            cg.add_global(cg.RawStatement(f"static uint32_t {name}[{size}];"))
+        cg.add(
+            var.get_power_window().set_storage(
+                *[cg.RawExpression(name) for name in storage], size
+            )
+        )
+
+    # Fixed point, in nW, nA and nV per Hz
+    multipliers = [
+        round(m * 1e9)
+        for m in MODELS[config[CONF_MODEL]](
+            config[CONF_CURRENT_RESISTOR], config[CONF_VOLTAGE_DIVIDER]
+        )
+    ]
+    cg.add(var.set_multipliers(*multipliers))
+
+    for conf in config.get(CONF_ON_OVERLOAD, []):
+        # CF period in us at the threshold power, P = multiplier / period
+        threshold_period = multipliers[0] * 1e6 / (conf[CONF_THRESHOLD] * 1e9)
+        trigger = cg.new_Pvariable(
+            conf[CONF_TRIGGER_ID], round(threshold_period), conf[CONF_DURATION]
+        )
+        cg.add(var.add_overload_trigger(trigger))
+        await automation.build_automation(trigger, [(float, "x")], conf)
+
+    if CONF_HISTORY in config:
+        conf = config[CONF_HISTORY]
+        num_blocks = conf[CONF_BUFFER_SIZE] // HISTORY_BLOCK_SIZE
+        name = f"{config[CONF_ID]}_history"
+        cg.add_global(
+            cg.RawStatement(
+                f"static uint8_t {name}[{num_blocks * HISTORY_BLOCK_SIZE}];"
+            )
+        )
+        cg.add(var.get_history().set_storage(cg.RawExpression(name), num_blocks))
+        cg.add(var.set_history_batch_size(conf[CONF_BATCH_SIZE]))
+        cg.add(var.set_history_flush_interval(conf[CONF_FLUSH_INTERVAL]))
+        for trigger_conf in conf[CONF_ON_FLUSH]:
+            trigger = cg.new_Pvariable(trigger_conf[CONF_TRIGGER_ID])
+            cg.add(var.add_history_flush_trigger(trigger))
+            await automation.build_automation(
+                trigger,
+                [(cg.std_vector.template(HLW8012HistorySample), "x")],
+                trigger_conf,
+            )
+
     if CONF_ENERGY in config:
-        sens = await sensor.new_sensor(config[CONF_ENERGY])
+        conf = config[CONF_ENERGY]
+        sens = await sensor.new_sensor(conf)
         cg.add(var.set_energy_sensor(sens))
-    cg.add(var.set_current_resistor(config[CONF_CURRENT_RESISTOR]))
-    cg.add(var.set_voltage_divider(config[CONF_VOLTAGE_DIVIDER]))
+        cg.add(var.set_restore_energy(conf[CONF_RESTORE]))
+        # Wh to CF pulses
+        save_delta = conf[CONF_ENERGY_SAVE_DELTA] * 3600 * 1e9 / multipliers[0]
+        cg.add(var.set_energy_save_delta(max(round(save_delta), 1)))
+        cg.add(var.set_energy_save_interval(conf[CONF_ENERGY_SAVE_INTERVAL]))
     cg.add(var.set_initial_mode(INITIAL_MODES[config[CONF_INITIAL_MODE]]))
-    cg.add(var.set_sensor_model(config[CONF_MODEL]))
+    cg.add(var.set_measurement_mode(config[CONF_MEASUREMENT_MODE]))
 
     interval = config[CONF_CHANGE_MODE_EVERY]
     if interval == "never":
         interval = 0
+    elif interval == "adaptive":
+        cg.add(var.set_adaptive_mode_switching(True))
+        interval = 0
     cg.add(var.set_change_mode_every(interval))
@@ -0,0 +1,53 @@
+import esphome.codegen as cg
+import esphome.config_validation as cv
+from esphome import automation
+from esphome.components import uart
+from esphome.const import CONF_ID
+
+DEPENDENCIES = ["uart"]
+MULTI_CONF = True
+
+CONF_CAPTURE_BUFFER_SIZE = "capture_buffer_size"
+CONF_LOGICA_DTOUCH_ID = "logica_dtouch_id"
+CONF_MAX_RETRIES = "max_retries"
+CONF_RESPONSE_TIMEOUT = "response_timeout"
+
+logica_dtouch_ns = cg.esphome_ns.namespace("logica_dtouch")
+LOGICA_dTouchBus = logica_dtouch_ns.class_("LOGICA_dTouchBus", cg.Component, uart.UARTDevice)
+DumpCaptureAction = logica_dtouch_ns.class_("DumpCaptureAction", automation.Action)
+
+CONFIG_SCHEMA = (
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.declare_id(LOGICA_dTouchBus),
+            cv.Optional(CONF_RESPONSE_TIMEOUT, default="500ms"): cv.positive_time_period_milliseconds,
+            cv.Optional(CONF_MAX_RETRIES, default=2): cv.int_range(min=0, max=10),
+            # Bytes of raw traffic kept for logica_dtouch.dump_capture, 0 disables the capture
+            cv.Optional(CONF_CAPTURE_BUFFER_SIZE, default=0): cv.int_range(min=0, max=65535),
+        }
+    )
+    .extend(uart.UART_DEVICE_SCHEMA)
+)
+
+
+async def to_code(config):
+    var = cg.new_Pvariable(config[CONF_ID])
+    await cg.register_component(var, config)
+    await uart.register_uart_device(var, config)
+    cg.add(var.set_response_timeout(config[CONF_RESPONSE_TIMEOUT]))
+    cg.add(var.set_max_retries(config[CONF_MAX_RETRIES]))
+    if config[CONF_CAPTURE_BUFFER_SIZE]:
+        buffer = f"{config[CONF_ID].id}_capture"
+        cg.add_global(cg.RawStatement(f"static uint8_t {buffer}[{config[CONF_CAPTURE_BUFFER_SIZE]}];"))
+        cg.add(var.set_capture_buffer(cg.RawExpression(buffer), config[CONF_CAPTURE_BUFFER_SIZE]))
+
+
+@automation.register_action(
+    "logica_dtouch.dump_capture",
+    DumpCaptureAction,
+    cv.Schema({cv.GenerateID(): cv.use_id(LOGICA_dTouchBus)}),
+)
+async def dump_capture_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    return var
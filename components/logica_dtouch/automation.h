@@ -0,0 +1,60 @@
+#pragma once
+
+#include "esphome/core/automation.h"
+#include "logica_dtouch.h"
+
+namespace esphome {
+namespace logica_dtouch {
+
+// Moves a command group of the device, or all of them, to the front of the bus queue
+template<typename... Ts> class RefreshAction : public Action<Ts...>, public Parented<LOGICA_dTouch> {
+ public:
+  void set_command(uint8_t command, uint8_t data) {
+    command_ = command;
+    data_ = data;
+    all_ = false;
+  }
+
+  void play(Ts... x) override {
+    if (all_) {
+      this->parent_->refresh();
+    } else {
+      this->parent_->refresh(command_, data_);
+    }
+  }
+
+ protected:
+  uint8_t command_{0};
+  uint8_t data_{0};
+  bool all_{true};
+};
+
+// Fires with whether the device answered once a refreshed command group, or any of them, has completed
+class RefreshCompleteTrigger : public Trigger<bool> {
+ public:
+  explicit RefreshCompleteTrigger(LOGICA_dTouch *parent) {
+    parent->add_on_refresh_complete_callback([this](const dtouch_command &command, bool success) {
+      if (this->all_ || (command.command == this->command_ && command.data == this->data_))
+        this->trigger(success);
+    });
+  }
+  void set_command(uint8_t command, uint8_t data) {
+    command_ = command;
+    data_ = data;
+    all_ = false;
+  }
+
+ protected:
+  uint8_t command_{0};
+  uint8_t data_{0};
+  bool all_{true};
+};
+
+// Logs the traffic captured on the bus
+template<typename... Ts> class DumpCaptureAction : public Action<Ts...>, public Parented<LOGICA_dTouchBus> {
+ public:
+  void play(Ts... x) override { this->parent_->dump_capture(); }
+};
+
+}  // namespace logica_dtouch
+}  // namespace esphome
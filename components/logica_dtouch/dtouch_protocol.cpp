@@ -0,0 +1,159 @@
+#include "dtouch_protocol.h"
+
+namespace esphome {
+namespace logica_dtouch {
+
+static const uint8_t DTOUCH_STATIC_HEADER[] = { 0x80, 0x00, 0x00 };
+
+// A nibble-wide table keeps the lookup at 32 bytes, which matters on ESP8266 where const data lives in RAM.
+struct dtouch_crc_table {
+  uint16_t values[16];
+};
+
+static constexpr dtouch_crc_table dtouch_crc_table_generate() {
+  dtouch_crc_table table{};
+  for (uint16_t nibble = 0; nibble < 16; nibble++) {
+    uint16_t crc = nibble;
+    for (uint8_t j = 0; j < 4; j++)
+      crc = (crc & 0x0001) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+    table.values[nibble] = crc;
+  }
+  return table;
+}
+
+static constexpr dtouch_crc_table DTOUCH_CRC_TABLE = dtouch_crc_table_generate();
+
+uint16_t dtouch_crc(const uint8_t *bytes, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    crc = (crc >> 4) ^ DTOUCH_CRC_TABLE.values[crc & 0x0F];
+    crc = (crc >> 4) ^ DTOUCH_CRC_TABLE.values[crc & 0x0F];
+  }
+
+  return crc;
+}
+uint16_t dtouch_crc(const uint8_t byte, uint16_t crc) { return dtouch_crc(&byte, 1, crc); }
+uint16_t dtouch_crc(const uint8_t *bytes, size_t len) { return dtouch_crc(bytes, len, 0xFFFF); }
+uint16_t dtouch_crc(const uint8_t byte) { return dtouch_crc(&byte, 1, 0xFFFF); }
+
+size_t dtouch_build_request(uint8_t *frame, const size_t frame_len, const uint8_t address, const uint8_t command,
+                            const uint8_t *data, const size_t data_len) {
+  const size_t length = DTOUCH_HEADER_LENGTH + 1 + data_len + DTOUCH_CRC_LENGTH;
+  if (length > frame_len)
+    return 0;
+  size_t index = 0;
+  frame[index++] = address;
+  for (uint8_t byte : DTOUCH_STATIC_HEADER)
+    frame[index++] = byte;
+  uint16_t payload_length = data_len + 1;
+  frame[index++] = payload_length >> 8;
+  frame[index++] = payload_length;
+  frame[index++] = command;
+  for (size_t i = 0; i < data_len; i++)
+    frame[index++] = data[i];
+  uint16_t crc = dtouch_crc(frame, index);
+  frame[index++] = crc;
+  frame[index++] = crc >> 8;
+  return index;
+}
+
+DTouchReceiveResult DTouchFrameReceiver::feed(uint8_t byte) {
+  if (this->index_ == 0 && byte != this->address_)
+    return DTOUCH_RECEIVE_NONE;
+  if (this->index_ == 1 && byte != 0x80) {
+    this->index_ = 0;
+    return DTOUCH_RECEIVE_RESYNC;
+  }
+  if (this->index_ == 4)
+    this->length_ = byte << 8;
+  if (this->index_ == 5) {
+    this->length_ += byte + DTOUCH_HEADER_LENGTH + DTOUCH_CRC_LENGTH;
+    if (this->length_ > DTOUCH_MAX_RESPONSE_LENGTH) {
+      this->index_ = 0;
+      return DTOUCH_RECEIVE_TOO_LONG;
+    }
+    // Every response carries a payload, an empty one is noise that happened to match the header
+    if (this->length_ <= DTOUCH_HEADER_LENGTH + DTOUCH_CRC_LENGTH) {
+      this->index_ = 0;
+      return DTOUCH_RECEIVE_RESYNC;
+    }
+  }
+  // Never trust the length to stop the frame, it is only known from byte 5 on
+  if (this->index_ >= DTOUCH_MAX_RESPONSE_LENGTH) {
+    this->index_ = 0;
+    return DTOUCH_RECEIVE_RESYNC;
+  }
+  // The CRC is accumulated as bytes arrive, so the frame is verified the moment its last byte lands.
+  // Running CRC-16/MODBUS over a frame including its own (low byte first) checksum leaves a zero residue.
+  const bool started = this->index_ == 0;
+  if (started) {
+    this->crc_ = 0xFFFF;
+    // The length of the previous frame must not end this one before its own length arrives
+    this->length_ = DTOUCH_MAX_RESPONSE_LENGTH;
+  }
+  if (this->index_ + DTOUCH_CRC_LENGTH == this->length_)
+    this->payload_crc_ = this->crc_;
+  this->crc_ = dtouch_crc(byte, this->crc_);
+  this->frame_[this->index_++] = byte;
+  if (this->index_ == this->length_) {
+    this->index_ = 0;
+    return this->crc_ == 0 ? DTOUCH_RECEIVE_FRAME : DTOUCH_RECEIVE_BAD_CHECKSUM;
+  }
+  return started ? DTOUCH_RECEIVE_STARTED : DTOUCH_RECEIVE_NONE;
+}
+
+void DTouchCapture::append_(DTouchCaptureType type, uint32_t time, const uint8_t *bytes, uint8_t length) {
+  const size_t record_len = DTOUCH_CAPTURE_RECORD_HEADER + length;
+  if (record_len > this->size_)
+    return;
+  while (this->used_ + record_len > this->size_) {
+    const size_t oldest_len = DTOUCH_CAPTURE_RECORD_HEADER + this->buffer_[(this->head_ + 5) % this->size_];
+    this->head_ = (this->head_ + oldest_len) % this->size_;
+    this->used_ -= oldest_len;
+  }
+  this->put_(type);
+  for (uint8_t shift = 0; shift < 32; shift += 8)
+    this->put_(time >> shift);
+  this->put_(length);
+  for (uint8_t i = 0; i < length; i++)
+    this->put_(bytes[i]);
+}
+
+size_t DTouchCapture::dump(size_t offset, uint8_t *out, size_t len) const {
+  size_t copied = 0;
+  for (; copied < len && offset < this->dump_length(); copied++, offset++) {
+    if (offset < sizeof(DTOUCH_CAPTURE_MAGIC)) {
+      out[copied] = DTOUCH_CAPTURE_MAGIC[offset];
+    } else {
+      out[copied] = this->buffer_[(this->head_ + offset - sizeof(DTOUCH_CAPTURE_MAGIC)) % this->size_];
+    }
+  }
+  return copied;
+}
+
+bool dtouch_capture_parse(const uint8_t *dump, const size_t len, size_t *pos, dtouch_capture_record *record) {
+  if (*pos == 0) {
+    if (len < sizeof(DTOUCH_CAPTURE_MAGIC))
+      return false;
+    for (size_t i = 0; i < sizeof(DTOUCH_CAPTURE_MAGIC); i++) {
+      if (dump[i] != DTOUCH_CAPTURE_MAGIC[i])
+        return false;
+    }
+    *pos = sizeof(DTOUCH_CAPTURE_MAGIC);
+  }
+  if (*pos + DTOUCH_CAPTURE_RECORD_HEADER > len)
+    return false;
+  const uint8_t *header = dump + *pos;
+  const size_t length = header[5];
+  if (*pos + DTOUCH_CAPTURE_RECORD_HEADER + length > len)
+    return false;
+  record->type = static_cast<DTouchCaptureType>(header[0]);
+  record->time = header[1] | (header[2] << 8) | (header[3] << 16) | ((uint32_t) header[4] << 24);
+  record->bytes = header + DTOUCH_CAPTURE_RECORD_HEADER;
+  record->length = length;
+  *pos += DTOUCH_CAPTURE_RECORD_HEADER + length;
+  return true;
+}
+
+}  // namespace logica_dtouch
+}  // namespace esphome
@@ -0,0 +1,177 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+// Framing, checksum and field decoding of the dTouch protocol. Deliberately free of ESPHome and UART dependencies,
+// so the same code can be linked into an off-target harness and fed recorded or simulated byte streams.
+
+namespace esphome {
+namespace logica_dtouch {
+
+static const size_t DTOUCH_MAX_RESPONSE_LENGTH = 128;
+// Address, 0x80, two reserved bytes and the 16 bit payload length
+static const size_t DTOUCH_HEADER_LENGTH = 6;
+static const size_t DTOUCH_CRC_LENGTH = 2;
+// A request carries the command byte and at most a few bytes of data
+static const size_t DTOUCH_MAX_REQUEST_LENGTH = 16;
+
+// The CRC used is CRC-16/MODBUS, sent low byte first
+uint16_t dtouch_crc(const uint8_t *bytes, size_t len, uint16_t crc);
+uint16_t dtouch_crc(const uint8_t byte, uint16_t crc);
+uint16_t dtouch_crc(const uint8_t *bytes, size_t len);
+uint16_t dtouch_crc(const uint8_t byte);
+
+// Writes a complete request frame to frame and returns its length, or 0 if it does not fit
+size_t dtouch_build_request(uint8_t *frame, const size_t frame_len, const uint8_t address, const uint8_t command,
+                            const uint8_t *data, const size_t data_len);
+
+// Marks a field that is always present rather than being one of a counted list
+static const uint8_t DTOUCH_NO_COUNT = 0xFF;
+
+// Describes where one value sits in a response frame and which sensor it is published to
+struct dtouch_field {
+  // Offset of the big endian value from the start of the frame
+  uint8_t offset;
+  // 1 or 2 bytes
+  uint8_t width;
+  uint16_t mask;
+  float scale;
+  // Index into the sensor table of the device
+  uint8_t slot;
+  // For counted lists (probes), the field is only present if index < frame[count_offset]
+  uint8_t count_offset;
+  uint8_t index;
+};
+
+// A request and the layout of its response, generated by codegen
+struct dtouch_command {
+  uint8_t command;
+  uint8_t data;
+  const dtouch_field *fields;
+  uint8_t num_fields;
+  // Response timeout in ms, 0 uses the bus default
+  uint32_t timeout;
+};
+
+// Calls publish(slot, value) for every field of the layout that is present in the checksum-verified frame
+template<typename F>
+void dtouch_decode(const dtouch_command &command, const uint8_t *frame, const size_t len, F &&publish) {
+  // The last two bytes of the frame are the checksum
+  const size_t payload_end = len - DTOUCH_CRC_LENGTH;
+  for (uint8_t i = 0; i < command.num_fields; i++) {
+    const dtouch_field &field = command.fields[i];
+    if (field.offset + field.width > payload_end)
+      continue;
+    if (field.count_offset != DTOUCH_NO_COUNT &&
+        (field.count_offset >= payload_end || field.index >= frame[field.count_offset]))
+      continue;
+    uint16_t raw = frame[field.offset];
+    if (field.width == 2)
+      raw = (raw << 8) | frame[field.offset + 1];
+    publish(field.slot, (raw & field.mask) * field.scale);
+  }
+}
+
+enum DTouchReceiveResult {
+  // Byte consumed, no frame boundary reached
+  DTOUCH_RECEIVE_NONE,
+  // The byte started a new frame
+  DTOUCH_RECEIVE_STARTED,
+  // A partial frame was discarded because the byte did not fit the header
+  DTOUCH_RECEIVE_RESYNC,
+  // The announced length exceeds the buffer, the frame was discarded
+  DTOUCH_RECEIVE_TOO_LONG,
+  // A complete frame with a bad checksum was discarded
+  DTOUCH_RECEIVE_BAD_CHECKSUM,
+  // A complete, checksum-verified frame is in the buffer
+  DTOUCH_RECEIVE_FRAME
+};
+
+// Reassembles response frames from a byte stream, verifying the checksum as the bytes arrive
+class DTouchFrameReceiver {
+ public:
+  // Starts waiting for a frame from address, discarding any partial frame
+  void reset(uint8_t address) {
+    address_ = address;
+    reset();
+  }
+  void reset() { index_ = 0; }
+  DTouchReceiveResult feed(uint8_t byte);
+
+  bool in_frame() const { return index_ != 0; }
+  const uint8_t *frame() const { return frame_; }
+  size_t length() const { return length_; }
+  // Checksum calculated over the payload of the last frame, for diagnostics after DTOUCH_RECEIVE_BAD_CHECKSUM
+  uint16_t payload_crc() const { return payload_crc_; }
+
+ protected:
+  uint8_t frame_[DTOUCH_MAX_RESPONSE_LENGTH];
+  uint8_t address_{0};
+  size_t index_{0};
+  size_t length_{0};
+  uint16_t crc_{0xFFFF};
+  uint16_t payload_crc_{0xFFFF};
+};
+
+enum DTouchCaptureType : uint8_t {
+  // A request frame as written to the UART
+  DTOUCH_CAPTURE_TX = 0x01,
+  // Bytes as read from the UART while a response was expected, whether or not they formed a valid frame
+  DTOUCH_CAPTURE_RX = 0x02,
+  // Bytes left in the UART buffer and discarded before a request
+  DTOUCH_CAPTURE_STALE = 0x03,
+  // The response timeout expired, the record carries no bytes
+  DTOUCH_CAPTURE_TIMEOUT = 0x04,
+};
+
+// A dump is the magic followed by the records, oldest first. Each record is the type, the time in ms as a
+// little endian uint32, the number of bytes and the bytes themselves.
+static const uint8_t DTOUCH_CAPTURE_MAGIC[] = {'d', 'T', 'C', 0x01};
+static const size_t DTOUCH_CAPTURE_RECORD_HEADER = 6;
+
+struct dtouch_capture_record {
+  DTouchCaptureType type;
+  uint32_t time;
+  const uint8_t *bytes;
+  uint8_t length;
+};
+
+// Ring of raw bus traffic. The oldest records are dropped whole to make room, so a dump always starts on a
+// record boundary. Without storage recording is a single comparison.
+class DTouchCapture {
+ public:
+  void set_storage(uint8_t *buffer, size_t size) {
+    buffer_ = buffer;
+    size_ = size;
+  }
+  bool enabled() const { return size_ != 0; }
+  size_t size() const { return size_; }
+
+  void record(DTouchCaptureType type, uint32_t time, const uint8_t *bytes, uint8_t length) {
+    if (this->size_ != 0)
+      this->append_(type, time, bytes, length);
+  }
+
+  // Length of the dump, including the magic
+  size_t dump_length() const { return sizeof(DTOUCH_CAPTURE_MAGIC) + used_; }
+  // Copies up to len bytes of the dump starting at offset to out and returns how many were copied
+  size_t dump(size_t offset, uint8_t *out, size_t len) const;
+
+ protected:
+  void append_(DTouchCaptureType type, uint32_t time, const uint8_t *bytes, uint8_t length);
+  void put_(uint8_t byte) { buffer_[(head_ + used_++) % size_] = byte; }
+
+  uint8_t *buffer_{nullptr};
+  size_t size_{0};
+  // Start of the oldest record and the number of bytes in use
+  size_t head_{0};
+  size_t used_{0};
+};
+
+// Reads the record at *pos of a dump and moves pos past it, for replaying captures off-target. The magic is
+// checked and skipped when pos is 0. Returns false at the end of the dump or if it is malformed.
+bool dtouch_capture_parse(const uint8_t *dump, const size_t len, size_t *pos, dtouch_capture_record *record);
+
+}  // namespace logica_dtouch
+}  // namespace esphome
@@ -7,341 +7,473 @@ namespace esphome {
 namespace logica_dtouch {
 
 static const char *const TAG = "logica_dtouch";
-static const size_t DTOUCH_MAX_RESPONSE_LENGTH = 128;
-static const size_t DTOUCH_HEADER_LENGTH = 6;
-static const size_t DTOUCH_STATIC_HEADER_LENGTH = 3;
-static const uint8_t DTOUCH_STATIC_HEADER[] = { 0x80, 0x00, 0x00 };
-
-enum SUPPORTED_COMMMANDS {
-  COMMAND_MC,
-  COMMAND_EMC,
-  COMMAND_TEMPERATURE,
-  COMMAND_CONTROL_VALUES
-};
-
-// The CRC used is CRC-16/MODBUS, sent low byte first
-uint16_t dtouch_crc(const uint8_t *bytes, size_t len, uint16_t crc) {
-  uint8_t i, j;
-
-  for (i = 0; i < len; i++) {
-      crc ^= bytes[i];
-      for (j = 0; j < 8; j++) {
-          if (crc & 0x0001) {
-              crc >>= 1;
-              crc ^= 0xA001;
-          } else {
-              crc >>= 1;
-          }
-      }
-  }
 
-  return crc;
+void dtouch_latency_histogram::add(uint32_t latency) {
+  uint8_t bucket = latency ? 32 - __builtin_clz(latency) : 0;
+  if (bucket >= DTOUCH_LATENCY_BUCKETS)
+    bucket = DTOUCH_LATENCY_BUCKETS - 1;
+  // Saturate rather than wrap, the histogram is cleared on every publish anyway
+  if (this->count == UINT16_MAX)
+    return;
+  this->buckets[bucket]++;
+  this->count++;
+  this->sum += latency;
 }
-uint16_t dtouch_crc(const uint8_t byte, uint16_t crc) { return dtouch_crc(&byte, 1, crc); }
-uint16_t dtouch_crc(const uint8_t *bytes, size_t len) { return dtouch_crc(bytes, len, 0xFFFF); }
-uint16_t dtouch_crc(const uint8_t byte) { return dtouch_crc(&byte, 1, 0xFFFF); }
 
-
-void LOGICA_dTouch::setup() {
-  this->use_command_control_values_ = (
-    this->temperature_sensor_ideal_ != nullptr ||
-    this->temperature_sensor_final_ != nullptr ||
-    this->emc_sensor_ideal_ != nullptr ||
-    this->emc_sensor_final_ != nullptr ||
-    this->mc_sensor_final_ != nullptr ||
-    this->heating_sensor_ != nullptr ||
-    this->fans_sensor_ != nullptr ||
-    this->flaps_sensor_ != nullptr ||
-    this->sprayer_sensor_ != nullptr
-  );
+float dtouch_latency_histogram::percentile(uint8_t percent) const {
+  if (!this->count)
+    return NAN;
+  const uint32_t target = ((uint32_t) this->count * percent + 99) / 100;
+  uint32_t seen = 0;
+  for (uint8_t i = 0; i < DTOUCH_LATENCY_BUCKETS; i++) {
+    seen += this->buckets[i];
+    if (seen >= target)
+      return (1UL << i) - 1;
+  }
+  return (1UL << (DTOUCH_LATENCY_BUCKETS - 1)) - 1;
 }
 
 void LOGICA_dTouch::loop() {
-  // Run the update loop
-  if (update_interval_ == UINT32_MAX)
+  // Publish queued updates until the time budget runs out, at least one per loop
+  const uint32_t start = micros();
+  while (this->publish_queue_count_) {
+    sensor_update &update = this->publish_queue_[this->publish_queue_head_];
+    this->publish_queue_head_ = (this->publish_queue_head_ + 1) % this->publish_queue_size_;
+    this->publish_queue_count_--;
+    update.sensor->publish_state(update.value);
+    if (micros() - start > this->publish_budget_)
+      break;
+  }
+  // Nothing to do until the next response is decoded
+  if (!this->publish_queue_count_)
+    this->disable_loop();
+}
+
+void LOGICA_dTouch::publish_slot_(dtouch_slot &slot, float value) {
+  const uint32_t now = millis();
+  const bool filtered = slot.deadband > 0.0f || slot.relative_deadband > 0.0f;
+  if (filtered && !std::isnan(slot.last_value) && !std::isnan(value) &&
+      (!slot.max_age || now - slot.last_publish < slot.max_age)) {
+    const float band = std::max(slot.deadband, slot.relative_deadband * std::fabs(slot.last_value));
+    if (std::fabs(value - slot.last_value) <= band)
+      return;
+  }
+  slot.last_value = value;
+  slot.last_publish = now;
+  this->queue_publish_(slot.sensor, value);
+}
+
+void LOGICA_dTouch::queue_publish_(sensor::Sensor *sensor, float value) {
+  // A newer value replaces the one still waiting for the same sensor
+  for (size_t i = 0; i < this->publish_queue_count_; i++) {
+    sensor_update &update = this->publish_queue_[(this->publish_queue_head_ + i) % this->publish_queue_size_];
+    if (update.sensor == sensor) {
+      update.value = value;
+      return;
+    }
+  }
+  if (this->publish_queue_count_ == this->publish_queue_size_) {
+    ESP_LOGW(TAG, "Publish queue full, dropping update");
     return;
-  static uint32_t last_update = 0;
-  uint32_t time = millis();
-  if (time - last_update > this->update_interval_) {
-    this->update();
-    last_update = time;
   }
+  const size_t tail = (this->publish_queue_head_ + this->publish_queue_count_) % this->publish_queue_size_;
+  this->publish_queue_[tail] = {sensor, value};
+  if (!this->publish_queue_count_++)
+    this->enable_loop();
+  if (this->publish_queue_count_ > this->stats_.publish_queue_high_water)
+    this->stats_.publish_queue_high_water = this->publish_queue_count_;
+}
 
-  // Send one update from the queue, if any
-  if (!this->publish_queue_.empty()) {
-    sensor_update update = this->publish_queue_.front();
-    this->publish_queue_.pop();
-    update.sensor->publish_state(update.value);
+void LOGICA_dTouch::setup() {
+  const uint32_t now = millis();
+  for (uint8_t i = 0; i < this->num_commands_; i++) {
+    dtouch_schedule &schedule = this->commands_[i];
+    if (!schedule.interval)
+      schedule.interval = this->get_update_interval();
+    schedule.next_due = now;
   }
+}
 
-  // Parse incoming data
-  static uint8_t response[DTOUCH_MAX_RESPONSE_LENGTH];
+void LOGICA_dTouch::update() { this->publish_diagnostics_(); }
 
-  size_t received_length = this->dtouch_receive_packet_(response, DTOUCH_MAX_RESPONSE_LENGTH);
+void LOGICA_dTouch::refresh() {
+  for (uint8_t i = 0; i < this->num_commands_; i++)
+    this->commands_[i].refresh = true;
+  this->parent_->wake();
+}
 
-  if (!received_length)
+void LOGICA_dTouch::refresh(uint8_t index) {
+  if (index >= this->num_commands_)
     return;
+  this->commands_[index].refresh = true;
+  this->parent_->wake();
+}
 
-  if (millis() - last_sent_command_.time > 500) {
-    ESP_LOGW(TAG, "Received unsolicited packet");
-    return;
+void LOGICA_dTouch::refresh(uint8_t command, uint8_t data) {
+  for (uint8_t i = 0; i < this->num_commands_; i++) {
+    if (this->commands_[i].command.command == command && this->commands_[i].command.data == data) {
+      this->refresh(i);
+      return;
+    }
   }
+  ESP_LOGW(TAG, "Device %d has no command '%c' 0x%02X to refresh", this->address_, command, data);
+}
 
-  uint16_t checksum = dtouch_crc(response, received_length - 2);
-  if (response[received_length - 2] != (uint8_t) checksum || response[received_length - 1] != (uint8_t) (checksum >> 8)) {
-    ESP_LOGW(TAG, "dTouch checksum doesn't match: 0x%02X%02X!=0x%04X", response[received_length - 1], response[received_length - 2], checksum);
-    return;
+bool LOGICA_dTouch::get_cached(const sensor::Sensor *sensor, float *value, uint32_t *age) const {
+  for (uint8_t i = 0; i < this->num_sensors_; i++) {
+    const dtouch_slot &slot = this->sensors_[i];
+    if (slot.sensor != sensor)
+      continue;
+    if (std::isnan(slot.value))
+      return false;
+    *value = slot.value;
+    *age = millis() - slot.received;
+    return true;
   }
+  return false;
+}
 
-  switch (this->last_sent_command_.command) {
-    case 'P':
-      switch (this->last_sent_command_.data)
-      {
-      case 0x00:
-        this->dtouch_parse_packet_P_00_(response, received_length);
-        break;
-      case 0x02:
-        this->dtouch_parse_packet_P_02_(response, received_length);
-        break;
-      case 0x03:
-        this->dtouch_parse_packet_P_03_(response, received_length);
-        break;
-      case 0x10:
-        this->dtouch_parse_packet_P_10_(response, received_length);
-        break;
-      default:
-        break;
-      }
-      break;
-    default:
-      break;
+void LOGICA_dTouch::publish_diagnostics_() {
+  // In DiagnosticSensor order
+  const float values[DIAGNOSTIC_COUNT] = {
+      this->stats_.first_byte.mean(),
+      this->stats_.frame.mean(),
+      this->stats_.frame.percentile(95),
+      (float) this->stats_.crc_errors,
+      (float) this->stats_.timeouts,
+      (float) this->stats_.resyncs,
+      (float) this->stats_.publish_queue_high_water,
+  };
+  for (uint8_t i = 0; i < DIAGNOSTIC_COUNT; i++) {
+    if (this->diagnostic_sensors_[i] != nullptr)
+      this->diagnostic_sensors_[i]->publish_state(values[i]);
   }
+  // Latencies are reported per update interval, counters keep counting
+  this->stats_.first_byte.clear();
+  this->stats_.frame.clear();
 }
 
-void LOGICA_dTouch::update() {
-  static unsigned int current_command = 0;
-  switch (current_command) {
-    default:
-      current_command = 0;
-    case COMMAND_MC:
-      current_command++;
-      if (this->mc_sensor_ != nullptr) {
-        const uint8_t data = 0x00;
-        dtouch_send_command_('P', &data, 1);
-        break;
-      }
-    case COMMAND_EMC:
-      current_command++;
-      if (this->emc_sensor_ != nullptr) {
-        const uint8_t data = 0x02;
-        dtouch_send_command_('P', &data, 1);
-        break;
-      }
-    case COMMAND_TEMPERATURE:
-      current_command++;
-      if (this->temperature_sensor_ != nullptr) {
-        const uint8_t data = 0x03;
-        dtouch_send_command_('P', &data, 1);
-        break;
-      }
-    case COMMAND_CONTROL_VALUES:
-      current_command++;
-      if (this->use_command_control_values_) {
-        const uint8_t data = 0x10;
-        dtouch_send_command_('P', &data, 1);
-        break;
-      }
+bool LOGICA_dTouch::peek_next_request(const uint32_t now, dtouch_request *request, uint32_t *overdue) {
+  bool found = false;
+  for (uint8_t i = 0; i < this->num_commands_; i++) {
+    const dtouch_schedule &schedule = this->commands_[i];
+    if (!schedule.refresh && schedule.interval == SCHEDULER_DONT_RUN)
+      continue;
+    const int32_t lateness = schedule.refresh ? INT32_MAX : (int32_t) (now - schedule.next_due);
+    if (lateness < 0 || (found && (uint32_t) lateness <= *overdue))
+      continue;
+    found = true;
+    *overdue = lateness;
+    request->command = schedule.command.command;
+    request->data = schedule.command.data;
+    request->timeout = schedule.command.timeout;
+    request->index = i;
   }
+  return found;
 }
 
-void LOGICA_dTouch::dtouch_send_command_(const uint8_t command, const uint8_t *data, const size_t data_len) {
-  // Empty RX Buffer
-  while (this->available())
-    this->read();
-  
-  this->write_byte(this->address_);
-  uint16_t crc = dtouch_crc(this->address_);
-  this->write_array(DTOUCH_STATIC_HEADER, DTOUCH_STATIC_HEADER_LENGTH);
-  crc = dtouch_crc(DTOUCH_STATIC_HEADER, DTOUCH_STATIC_HEADER_LENGTH, crc);
-  uint16_t payload_length = data_len + 1;
-  uint8_t length_cmd[] = {(uint8_t) (payload_length >> 8), (uint8_t) payload_length, command};
-  this->write_array(length_cmd, 3);
-  crc = dtouch_crc(length_cmd, 3, crc);
-  if (data != nullptr) {
-    this->write_array(data, data_len);
-    crc = dtouch_crc(data, data_len, crc);
+void LOGICA_dTouch::start_request(const dtouch_request &request, const uint32_t now) {
+  dtouch_schedule &schedule = this->commands_[request.index];
+  schedule.refreshing = schedule.refresh;
+  schedule.refresh = false;
+  if (schedule.interval == SCHEDULER_DONT_RUN)
+    return;
+  // Keep the cadence, but never try to catch up on polls missed while the bus was saturated
+  schedule.next_due += schedule.interval;
+  if ((int32_t) (now - schedule.next_due) >= 0)
+    schedule.next_due = now + schedule.interval;
+}
+
+uint32_t LOGICA_dTouch::time_until_due(const uint32_t now) const {
+  uint32_t wait = UINT32_MAX;
+  for (uint8_t i = 0; i < this->num_commands_; i++) {
+    const dtouch_schedule &schedule = this->commands_[i];
+    if (!schedule.refresh && schedule.interval == SCHEDULER_DONT_RUN)
+      continue;
+    const int32_t remaining = schedule.refresh ? 0 : (int32_t) (schedule.next_due - now);
+    if (remaining <= 0)
+      return 0;
+    if ((uint32_t) remaining < wait)
+      wait = remaining;
   }
-  uint8_t crc_bytes[] = {(uint8_t) crc, uint8_t (crc >> 8)};
-  this->write_array(crc_bytes, 2);
-  this->flush();
+  return wait;
+}
 
-  this->last_sent_command_.command = command;
-  this->last_sent_command_.data = (data == nullptr) ? 0 : data[0];
-  this->last_sent_command_.time = millis();
+void LOGICA_dTouch::handle_response(const dtouch_request &request, const uint8_t *response, const size_t len) {
+  const uint32_t now = millis();
+  dtouch_decode(this->commands_[request.index].command, response, len, [this, now](uint8_t slot, float value) {
+    dtouch_slot &entry = this->sensors_[slot];
+    entry.value = value;
+    entry.received = now;
+    this->publish_slot_(entry, value);
+  });
+  this->complete_request_(request, true);
 }
 
-size_t LOGICA_dTouch::dtouch_receive_packet_(uint8_t *response, const size_t response_len) {
-  static size_t current_index = 0;
-  static size_t packet_length = 0;
+void LOGICA_dTouch::handle_failure(const dtouch_request &request) { this->complete_request_(request, false); }
 
-  static unsigned long last_read = 0;
+void LOGICA_dTouch::complete_request_(const dtouch_request &request, bool success) {
+  dtouch_schedule &schedule = this->commands_[request.index];
+  if (!schedule.refreshing)
+    return;
+  schedule.refreshing = false;
+  this->refresh_complete_callback_.call(schedule.command, success);
+}
 
-  while (this->available()) {
-    last_read = millis();
-    uint8_t data = this->read();
-    if (current_index == 0 && data != this->address_)
-      continue;
-    if (current_index == 1 && data != 0x80) {
-      current_index = 0;
-      continue;
-    }
-    if (current_index == 4)
-      packet_length = data << 8;
-    if (current_index == 5) {
-      packet_length += data + 8;
-      if (packet_length > response_len) {
-        ESP_LOGW(TAG, "Packet too long for array!");
-        current_index = 0;
-        continue;
-      }
-    }
-    if (current_index == response_len) {
-      current_index = 0;
-      continue;
-    }
-    response[current_index++] = data;
-    if (current_index == packet_length && current_index > 8) {
-      current_index = 0;
-      return packet_length;
+float LOGICA_dTouch::get_setup_priority() const { return setup_priority::DATA; }
+
+void LOGICA_dTouch::dump_config() {
+  ESP_LOGCONFIG(TAG, "Logica dTouch:");
+  ESP_LOGCONFIG(TAG, "  Device address: %d", this->address_);
+  LOG_UPDATE_INTERVAL(this);
+  ESP_LOGCONFIG(TAG, "  Publish queue: %zu entries, %" PRIu32 " us budget per loop", this->publish_queue_size_,
+                this->publish_budget_);
+  for (uint8_t i = 0; i < this->num_commands_; i++) {
+    const dtouch_schedule &schedule = this->commands_[i];
+    const dtouch_command &command = schedule.command;
+    if (schedule.interval == SCHEDULER_DONT_RUN) {
+      ESP_LOGCONFIG(TAG, "  Command '%c' 0x%02X: %d field(s), on refresh only", command.command, command.data,
+                    command.num_fields);
+    } else {
+      ESP_LOGCONFIG(TAG, "  Command '%c' 0x%02X: %d field(s), every %" PRIu32 " ms", command.command, command.data,
+                    command.num_fields, schedule.interval);
     }
   }
-
-  if (millis() - last_read > 10) {
-    current_index = 0;
-    last_read = millis();
+  for (uint8_t i = 0; i < this->num_sensors_; i++) {
+    const dtouch_slot &slot = this->sensors_[i];
+    LOG_SENSOR("  ", "Sensor", slot.sensor);
+    if (slot.deadband > 0.0f || slot.relative_deadband > 0.0f)
+      ESP_LOGCONFIG(TAG, "    Deadband: %.2f or %.1f%%, max age %" PRIu32 " ms", slot.deadband,
+                    slot.relative_deadband * 100.0f, slot.max_age);
   }
-  return 0;
 }
 
-void LOGICA_dTouch::dtouch_parse_packet_P_00_(const uint8_t *data, const size_t len) {
-  size_t index = DTOUCH_HEADER_LENGTH;
-  const float total_mc = ((data[index] << 8) | data[index+1]) / 10.0f;
-  this->publish_queue_.push({this->mc_sensor_, total_mc});
-  index += 2;
-  uint8_t num_probes = std::min(data[index++], (uint8_t) this->mc_probes_.size());
-  for (int i = 0; i < num_probes; i++) {
-    const float probe_mc = (((data[index] << 8) | data[index+1]) & 0xFFF) / 10.0f;
-    this->publish_queue_.push({this->mc_probes_.at(i), probe_mc});
-    index += 2;
+void LOGICA_dTouchBus::setup() {
+  for (size_t i = 0; i < this->devices_.size(); i++) {
+    for (size_t j = i + 1; j < this->devices_.size(); j++) {
+      if (this->devices_[i]->get_address() == this->devices_[j]->get_address())
+        ESP_LOGE(TAG, "Address %d is used by more than one device", this->devices_[i]->get_address());
+    }
   }
 }
 
-void LOGICA_dTouch::dtouch_parse_packet_P_02_(const uint8_t *data, const size_t len) {
-  size_t index = DTOUCH_HEADER_LENGTH;
-  const float total_emc = ((data[index] << 8) | data[index+1]) / 10.0f;
-  this->publish_queue_.push({this->emc_sensor_, total_emc});
-  index += 2;
-  uint8_t num_probes = std::min(data[index++], (uint8_t) this->emc_probes_.size());
-  for (int i = 0; i < num_probes; i++) {
-    const float probe_emc = (((data[index] << 8) | data[index+1]) & 0xFFF) / 10.0f;
-    this->publish_queue_.push({this->emc_probes_.at(i), probe_emc});
-    index += 2;
+void LOGICA_dTouchBus::loop() {
+  if (this->state_ == TRANSACTION_SENT || this->state_ == TRANSACTION_RECEIVING) {
+    if (this->dtouch_receive_packet_()) {
+      this->active_device_->get_stats().frame.add(millis() - this->last_sent_command_.time);
+      this->state_ = TRANSACTION_DONE;
+    }
+    if (this->state_ == TRANSACTION_DONE || this->state_ == TRANSACTION_TIMEOUT)
+      this->advance_();
+  } else {
+    // First pass after boot, start the schedule
+    this->advance_();
   }
+  // The loop only runs while a response is expected, the rest is driven by scheduler timeouts
+  if (this->state_ != TRANSACTION_SENT && this->state_ != TRANSACTION_RECEIVING)
+    this->disable_loop();
 }
 
-void LOGICA_dTouch::dtouch_parse_packet_P_03_(const uint8_t *data, const size_t len) {
-  size_t index = DTOUCH_HEADER_LENGTH;
-  const float total_temperature = ((data[index] << 8) | data[index+1]) / 10.0f;
-  this->publish_queue_.push({this->temperature_sensor_, total_temperature});
-  index += 2;
-  uint8_t num_probes = std::min(data[index++], (uint8_t) this->temperature_probes_.size());
-  for (int i = 0; i < num_probes; i++) {
-    const float probe_temperature = (((data[index] << 8) | data[index+1]) & 0xFFF) / 10.0f;
-    this->publish_queue_.push({this->temperature_probes_.at(i), probe_temperature});
-    index += 2;
-  }
+void LOGICA_dTouchBus::wake() {
+  if (this->state_ != TRANSACTION_IDLE)
+    return;
+  this->cancel_timeout("next_request");
+  this->advance_();
 }
 
-void LOGICA_dTouch::dtouch_parse_packet_P_10_(const uint8_t *data, const size_t len) {
-  size_t index = DTOUCH_HEADER_LENGTH;
-  if (this->temperature_sensor_ideal_ != nullptr) {
-    const float ideal_temperature = ((data[index] << 8) | data[index+1]) / 10.0f;
-    this->publish_queue_.push({this->temperature_sensor_ideal_, ideal_temperature});
+void LOGICA_dTouchBus::advance_() {
+  if (this->state_ == TRANSACTION_DONE) {
+    this->cancel_timeout("response");
+    this->active_device_->handle_response(this->active_request_, this->receiver_.frame(), this->receiver_.length());
+    this->state_ = TRANSACTION_IDLE;
   }
-  index += 2;
-  if (this->temperature_sensor_final_ != nullptr) {
-    const float final_temperature = ((data[index] << 8) | data[index+1]) / 10.0f;
-    this->publish_queue_.push({this->temperature_sensor_final_, final_temperature});
-  }
-  index += 2;
-  if (this->emc_sensor_ideal_ != nullptr) {
-    const float ideal_emc = ((data[index] << 8) | data[index+1]) / 10.0f;
-    this->publish_queue_.push({this->emc_sensor_ideal_, ideal_emc});
+
+  if (this->state_ == TRANSACTION_TIMEOUT) {
+    this->cancel_timeout("response");
+    if (this->attempt_ <= this->max_retries_) {
+      ESP_LOGD(TAG, "Device %d: no valid response to '%c' 0x%02X, retrying", this->active_device_->get_address(),
+               this->active_request_.command, this->active_request_.data);
+      this->send_active_request_();
+      return;
+    }
+    ESP_LOGW(TAG, "Device %d did not respond to '%c' 0x%02X after %d attempt(s)", this->active_device_->get_address(),
+             this->active_request_.command, this->active_request_.data, this->attempt_);
+    this->active_device_->handle_failure(this->active_request_);
+    this->state_ = TRANSACTION_IDLE;
   }
-  index += 2;
-  if (this->emc_sensor_final_ != nullptr) {
-    const float final_emc = ((data[index] << 8) | data[index+1]) / 10.0f;
-    this->publish_queue_.push({this->emc_sensor_final_, final_emc});
+
+  if (this->state_ != TRANSACTION_IDLE)
+    return;
+
+  // The bus is free, send the most overdue request right away. Ties go to the device after the one served last.
+  const uint32_t now = millis();
+  const size_t device_num = this->devices_.size();
+  LOGICA_dTouch *next_device = nullptr;
+  size_t next_index = 0;
+  uint32_t most_overdue = 0;
+  uint32_t wait = UINT32_MAX;
+  for (size_t i = 0; i < device_num; i++) {
+    const size_t index = (this->next_device_ + i) % device_num;
+    dtouch_request request;
+    uint32_t overdue = 0;
+    if (!this->devices_[index]->peek_next_request(now, &request, &overdue)) {
+      wait = std::min(wait, this->devices_[index]->time_until_due(now));
+      continue;
+    }
+    if (next_device != nullptr && overdue <= most_overdue)
+      continue;
+    next_device = this->devices_[index];
+    next_index = index;
+    most_overdue = overdue;
+    this->active_request_ = request;
   }
-  index += 2;
-  if (this->mc_sensor_final_ != nullptr) {
-    const float final_mc = ((data[index] << 8) | data[index+1]) / 10.0f;
-    this->publish_queue_.push({this->mc_sensor_final_, final_mc});
+  if (next_device == nullptr) {
+    // Sleep until the earliest deadline
+    if (wait != UINT32_MAX)
+      this->set_timeout("next_request", wait, [this]() { this->advance_(); });
+    return;
   }
-  index += 2;
-  index += 2;
-  if (this->heating_sensor_ != nullptr) {
-    const float heating_level = data[index];
-    this->publish_queue_.push({this->heating_sensor_, heating_level});
+
+  next_device->start_request(this->active_request_, now);
+  if (!this->active_request_.timeout)
+    this->active_request_.timeout = this->response_timeout_;
+  this->active_device_ = next_device;
+  this->next_device_ = next_index + 1;
+  this->attempt_ = 0;
+  this->send_active_request_();
+}
+
+void LOGICA_dTouchBus::send_active_request_() {
+  this->attempt_++;
+  this->first_byte_received_ = false;
+  this->dtouch_send_command_(this->active_device_->get_address(), this->active_request_.command,
+                             &this->active_request_.data, 1);
+  this->state_ = TRANSACTION_SENT;
+  this->set_timeout("response", this->active_request_.timeout, [this]() {
+    if (this->state_ != TRANSACTION_SENT && this->state_ != TRANSACTION_RECEIVING)
+      return;
+    this->active_device_->get_stats().timeouts++;
+    this->capture_.record(DTOUCH_CAPTURE_TIMEOUT, millis(), nullptr, 0);
+    this->state_ = TRANSACTION_TIMEOUT;
+    this->advance_();
+  });
+  this->enable_loop();
+}
+
+void LOGICA_dTouchBus::dtouch_send_command_(const uint8_t address, const uint8_t command, const uint8_t *data,
+                                            const size_t data_len) {
+  uint8_t frame[DTOUCH_MAX_REQUEST_LENGTH];
+  const size_t frame_len = dtouch_build_request(frame, sizeof(frame), address, command, data, data_len);
+  if (!frame_len) {
+    ESP_LOGE(TAG, "Request too long for array!");
+    return;
   }
-  index++;
-  if (this->fans_sensor_ != nullptr) {
-    const float fans_level = data[index];
-    this->publish_queue_.push({this->fans_sensor_, fans_level});
+
+  // Empty RX Buffer
+  uint8_t stale[32];
+  size_t available;
+  while ((available = this->available())) {
+    const size_t length = std::min(available, sizeof(stale));
+    if (!this->read_array(stale, length))
+      break;
+    this->capture_.record(DTOUCH_CAPTURE_STALE, millis(), stale, length);
   }
-  index++;
-  if (this->flaps_sensor_ != nullptr) {
-    const float flaps_level = data[index];
-    this->publish_queue_.push({this->flaps_sensor_, flaps_level});
+
+  this->write_array(frame, frame_len);
+  this->flush();
+
+  this->last_sent_command_.address = address;
+  this->last_sent_command_.command = command;
+  this->last_sent_command_.data = (data == nullptr) ? 0 : data[0];
+  this->last_sent_command_.time = millis();
+  this->capture_.record(DTOUCH_CAPTURE_TX, this->last_sent_command_.time, frame, frame_len);
+  this->receiver_.reset(address);
+  this->rx_last_read_ = this->last_sent_command_.time;
+}
+
+bool LOGICA_dTouchBus::dtouch_receive_packet_() {
+  dtouch_stats &stats = this->active_device_->get_stats();
+  uint8_t buffer[32];
+  size_t available;
+  while ((available = this->available())) {
+    const size_t length = std::min(available, sizeof(buffer));
+    if (!this->read_array(buffer, length))
+      break;
+    this->rx_last_read_ = millis();
+    this->capture_.record(DTOUCH_CAPTURE_RX, this->rx_last_read_, buffer, length);
+    // Anything after a complete frame is stray, the receiver is re-armed before the next request
+    for (size_t i = 0; i < length; i++) {
+      switch (this->receiver_.feed(buffer[i])) {
+        case DTOUCH_RECEIVE_STARTED:
+          if (!this->first_byte_received_) {
+            stats.first_byte.add(this->rx_last_read_ - this->last_sent_command_.time);
+            this->first_byte_received_ = true;
+          }
+          this->state_ = TRANSACTION_RECEIVING;
+          break;
+        case DTOUCH_RECEIVE_RESYNC:
+          stats.resyncs++;
+          this->state_ = TRANSACTION_SENT;
+          break;
+        case DTOUCH_RECEIVE_TOO_LONG:
+          ESP_LOGW(TAG, "Packet too long for array!");
+          stats.resyncs++;
+          this->state_ = TRANSACTION_SENT;
+          break;
+        case DTOUCH_RECEIVE_BAD_CHECKSUM: {
+          const uint8_t *frame = this->receiver_.frame();
+          const size_t len = this->receiver_.length();
+          ESP_LOGW(TAG, "dTouch checksum doesn't match: 0x%02X%02X!=0x%04X", frame[len - 1], frame[len - 2],
+                   this->receiver_.payload_crc());
+          stats.crc_errors++;
+          // The device has answered, a corrupted response is retried straight away like a missing one
+          this->state_ = TRANSACTION_TIMEOUT;
+          return false;
+        }
+        case DTOUCH_RECEIVE_FRAME:
+          return true;
+        default:
+          break;
+      }
+    }
   }
-  index++;
-  if (this->sprayer_sensor_ != nullptr) {
-    const float sprayer_level = data[index];
-    this->publish_queue_.push({this->sprayer_sensor_, sprayer_level});
+
+  if (millis() - this->rx_last_read_ > 10) {
+    if (this->receiver_.in_frame()) {
+      stats.resyncs++;
+      this->state_ = TRANSACTION_SENT;
+    }
+    this->receiver_.reset();
+    this->rx_last_read_ = millis();
   }
+  return false;
 }
 
-void LOGICA_dTouch::set_update_interval(uint32_t update_interval) {
-  if (update_interval == UINT32_MAX) {
-    this->update_interval_ = update_interval;
+void LOGICA_dTouchBus::dump_capture() {
+  if (!this->capture_.enabled()) {
+    ESP_LOGW(TAG, "Capture is disabled, set capture_buffer_size to enable it");
     return;
   }
-  if (!this->command_num_) {
-    this->update_interval_ = UINT32_MAX;
-    return;
+  const size_t length = this->capture_.dump_length();
+  ESP_LOGI(TAG, "Capture: %zu bytes, base64 encoded:", length);
+  // 48 bytes encode to a 64 character line
+  uint8_t chunk[48];
+  for (size_t offset = 0; offset < length; offset += sizeof(chunk)) {
+    const size_t chunk_len = this->capture_.dump(offset, chunk, sizeof(chunk));
+    ESP_LOGI(TAG, "  %s", base64_encode(chunk, chunk_len).c_str());
   }
-  this->update_interval_ = (update_interval) / this->command_num_;
-  if (this->update_interval_ < 500)
-    this->update_interval_ = 500;
 }
 
-float LOGICA_dTouch::get_setup_priority() const { return setup_priority::DATA; }
+float LOGICA_dTouchBus::get_setup_priority() const { return setup_priority::BUS; }
 
-void LOGICA_dTouch::dump_config() {
-  ESP_LOGCONFIG(TAG, "Logica dTouch:");
-  LOG_SENSOR("  ", "Temperautre", this->temperature_sensor_);
-  if (this->temperature_probes_.size())
-    ESP_LOGCONFIG(TAG, "    Temperature probes: %d", this->temperature_probes_.size());
-  LOG_SENSOR("  ", "MC", this->mc_sensor_);
-  if (this->mc_probes_.size())
-    ESP_LOGCONFIG(TAG, "    MC probes: %d", this->mc_probes_.size());
-  LOG_SENSOR("  ", "EMC", this->emc_sensor_);
-  if (this->emc_probes_.size())
-    ESP_LOGCONFIG(TAG, "    EMC probes: %d", this->emc_probes_.size());
-  ESP_LOGCONFIG(TAG, "  Sending %d command(s), one every %u ms", this->command_num_, this->update_interval_);
+void LOGICA_dTouchBus::dump_config() {
+  ESP_LOGCONFIG(TAG, "Logica dTouch bus:");
+  ESP_LOGCONFIG(TAG, "  Devices: %zu", this->devices_.size());
+  ESP_LOGCONFIG(TAG, "  Response timeout: %" PRIu32 " ms", this->response_timeout_);
+  ESP_LOGCONFIG(TAG, "  Max retries: %d", this->max_retries_);
+  if (this->capture_.enabled())
+    ESP_LOGCONFIG(TAG, "  Capture buffer: %zu bytes", this->capture_.size());
   this->check_uart_settings(57600, 1, uart::UART_CONFIG_PARITY_EVEN, 8);
-
-  ESP_LOGCONFIG(TAG, "  Device address: %d", this->address_);
 }
 
 }  // namespace logica_dtouch
@@ -1,92 +1,251 @@
 #pragma once
 
+#include <cmath>
 #include <vector>
-#include <queue>
 #include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
 #include "esphome/components/sensor/sensor.h"
 #include "esphome/components/uart/uart.h"
+#include "dtouch_protocol.h"
 
 namespace esphome {
 namespace logica_dtouch {
 
-class LOGICA_dTouch : public Component, public uart::UARTDevice {
- public:
-  float get_setup_priority() const override;
-
-  void setup() override;
-  void loop() override;
-  void dump_config() override;
-  // Implement our own update with custom timing
-  void update();
+enum TransactionState {
+  TRANSACTION_IDLE,
+  // Request written, waiting for the first byte of the response
+  TRANSACTION_SENT,
+  // Response header matched, collecting the rest of the frame
+  TRANSACTION_RECEIVING,
+  // A checksum-verified response is in the buffer
+  TRANSACTION_DONE,
+  // No valid response arrived in time, the request is retried or dropped
+  TRANSACTION_TIMEOUT
+};
 
-  void set_temperature_sensor(sensor::Sensor *sensor) { temperature_sensor_ = sensor; }
-  void set_temperature_sensor_ideal(sensor::Sensor *sensor) { temperature_sensor_ideal_ = sensor; }
-  void set_temperature_sensor_final(sensor::Sensor *sensor) { temperature_sensor_final_ = sensor; }
-  void add_temperature_probe(sensor::Sensor *probe) { temperature_probes_.push_back(probe); }
+struct dtouch_request {
+  uint8_t command;
+  uint8_t data;
+  uint32_t timeout;
+  // Index of the command on the device that issued the request
+  uint8_t index;
+};
 
-  void set_emc_sensor(sensor::Sensor *sensor) { emc_sensor_ = sensor; }
-  void set_emc_sensor_ideal(sensor::Sensor *sensor) { emc_sensor_ideal_ = sensor; }
-  void set_emc_sensor_final(sensor::Sensor *sensor) { emc_sensor_final_ = sensor; }
-  void add_emc_probe(sensor::Sensor *probe) { emc_probes_.push_back(probe); }
+// A command of a device together with its polling deadline
+struct dtouch_schedule {
+  dtouch_command command;
+  // Polling interval in ms, 0 uses the update interval of the device, SCHEDULER_DONT_RUN only polls on refresh()
+  uint32_t interval;
+  uint32_t next_due;
+  // Set by refresh(), sent ahead of any deadline
+  bool refresh;
+  // The request in flight was a refresh, completion is reported to the refresh callbacks
+  bool refreshing;
+};
 
-  void set_mc_sensor(sensor::Sensor *sensor) { mc_sensor_ = sensor; }
-  void set_mc_sensor_final(sensor::Sensor *sensor) { mc_sensor_final_ = sensor; }
-  void add_mc_probe(sensor::Sensor *probe) { mc_probes_.push_back(probe); }
+struct sensor_update {
+  sensor::Sensor *sensor;
+  float value;
+};
 
-  void set_heating_sensor(sensor::Sensor *sensor) { heating_sensor_ = sensor; }
-  void set_fans_sensor(sensor::Sensor *sensor) {fans_sensor_ = sensor; }
-  void set_flaps_sensor(sensor::Sensor *sensor) { flaps_sensor_ = sensor; }
-  void set_sprayer_sensor(sensor::Sensor *sensor) { sprayer_sensor_ = sensor; }
+// A sensor of the device with its publish filter
+struct dtouch_slot {
+  sensor::Sensor *sensor;
+  // Changes no larger than max(deadband, relative_deadband * |last value|) are not published, 0 for both disables
+  float deadband;
+  float relative_deadband;
+  // Publish anyway once the last published value is this old in ms, 0 never forces a publish
+  uint32_t max_age;
+  float last_value;
+  uint32_t last_publish;
+  // Last decoded value and when it was received in ms, whether or not the filter published it
+  float value;
+  uint32_t received;
+};
 
-  void set_address(uint32_t address) { address_ = address; }
-  void add_command() { command_num_++; }
-  void set_update_interval(uint32_t update_interval);
+static const uint8_t DTOUCH_LATENCY_BUCKETS = 16;
 
- protected:
-  void dtouch_send_command_(const uint8_t command) { dtouch_send_command_(command, nullptr, 0); }
-  void dtouch_send_command_(const uint8_t command, const uint8_t *data, const size_t data_len);
-  size_t dtouch_receive_packet_(uint8_t *response, const size_t response_len);
+// Log2 histogram of latencies in ms, bucket n > 0 counts latencies in [2^(n-1), 2^n)
+struct dtouch_latency_histogram {
+  uint16_t buckets[DTOUCH_LATENCY_BUCKETS];
+  uint16_t count;
+  uint32_t sum;
 
-  void dtouch_parse_packet_P_00_(const uint8_t *data, const size_t len);
-  void dtouch_parse_packet_P_02_(const uint8_t *data, const size_t len);
-  void dtouch_parse_packet_P_03_(const uint8_t *data, const size_t len);
-  void dtouch_parse_packet_P_10_(const uint8_t *data, const size_t len);
+  void add(uint32_t latency);
+  void clear() { *this = {}; }
+  float mean() const { return count ? (float) sum / count : NAN; }
+  // Upper bound of the bucket containing the given percentile
+  float percentile(uint8_t percent) const;
+};
 
-  sensor::Sensor *temperature_sensor_{nullptr};
-  sensor::Sensor *temperature_sensor_ideal_{nullptr};
-  sensor::Sensor *temperature_sensor_final_{nullptr};
-  std::vector<sensor::Sensor *> temperature_probes_;
+// Bus health of a single device, filled in by the bus
+struct dtouch_stats {
+  // Request to first byte of the response and request to checksum-verified frame
+  dtouch_latency_histogram first_byte;
+  dtouch_latency_histogram frame;
+  uint32_t crc_errors;
+  uint32_t timeouts;
+  // Partial frames discarded by the receiver
+  uint32_t resyncs;
+  size_t publish_queue_high_water;
+};
 
-  sensor::Sensor *emc_sensor_{nullptr};
-  sensor::Sensor *emc_sensor_ideal_{nullptr};
-  sensor::Sensor *emc_sensor_final_{nullptr};
-  std::vector<sensor::Sensor *> emc_probes_;
+enum DiagnosticSensor {
+  DIAGNOSTIC_FIRST_BYTE_LATENCY,
+  DIAGNOSTIC_RESPONSE_LATENCY,
+  DIAGNOSTIC_RESPONSE_LATENCY_P95,
+  DIAGNOSTIC_CRC_ERRORS,
+  DIAGNOSTIC_TIMEOUTS,
+  DIAGNOSTIC_RESYNCS,
+  DIAGNOSTIC_PUBLISH_QUEUE_HIGH_WATER,
+  DIAGNOSTIC_COUNT
+};
 
-  sensor::Sensor *mc_sensor_{nullptr};
-  sensor::Sensor *mc_sensor_final_{nullptr};
-  std::vector<sensor::Sensor *> mc_probes_;
+class LOGICA_dTouchBus;
 
-  sensor::Sensor *heating_sensor_{nullptr};
-  sensor::Sensor *fans_sensor_{nullptr};
-  sensor::Sensor *flaps_sensor_{nullptr};
-  sensor::Sensor *sprayer_sensor_{nullptr};
+// A single dTouch kiln controller on the bus, identified by its address
+class LOGICA_dTouch : public PollingComponent, public Parented<LOGICA_dTouchBus> {
+ public:
+  float get_setup_priority() const override;
 
-  struct sensor_update {
-    sensor::Sensor *sensor;
-    float value;
-  };
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+  // Commands are polled on their own deadlines, the update interval only paces the diagnostics
+  void update() override;
+
+  // Requests all commands, the command at index, or the given command ahead of any scheduled poll
+  void refresh();
+  void refresh(uint8_t index);
+  void refresh(uint8_t command, uint8_t data);
+  // Called with the command and whether it was answered once a refreshed command has completed or was dropped
+  void add_on_refresh_complete_callback(std::function<void(const dtouch_command &, bool)> &&callback) {
+    refresh_complete_callback_.add(std::move(callback));
+  }
+
+  // Last decoded value of the sensor and its age in ms, read from the cache without touching the bus. Returns false
+  // if the sensor does not belong to this device or nothing was received for it yet.
+  bool get_cached(const sensor::Sensor *sensor, float *value, uint32_t *age) const;
+
+  // Storage for both tables is allocated by codegen, sized for exactly the configured sensors and commands.
+  // Sensors are referenced by dtouch_field::slot, the commands are fully initialized by codegen.
+  void set_sensors(dtouch_slot *sensors, uint8_t num_sensors) {
+    sensors_ = sensors;
+    num_sensors_ = num_sensors;
+  }
+  void set_sensor(uint8_t slot, sensor::Sensor *sensor, float deadband, float relative_deadband, uint32_t max_age) {
+    sensors_[slot] = {sensor, deadband, relative_deadband, max_age, NAN, 0, NAN, 0};
+  }
+  void set_commands(dtouch_schedule *commands, uint8_t num_commands) {
+    commands_ = commands;
+    num_commands_ = num_commands;
+  }
+
+  void set_address(uint8_t address) { address_ = address; }
+  uint8_t get_address() const { return address_; }
+  // Storage is allocated by codegen with one slot per sensor of this device
+  void set_publish_queue(sensor_update *queue, size_t size) {
+    publish_queue_ = queue;
+    publish_queue_size_ = size;
+  }
+  void set_publish_budget(uint32_t publish_budget) { publish_budget_ = publish_budget; }
+  void set_diagnostic_sensor(DiagnosticSensor type, sensor::Sensor *sensor) { diagnostic_sensors_[type] = sensor; }
+
+  dtouch_stats &get_stats() { return stats_; }
+
+  // Called by the bus when it is idle. Fills in the most overdue request and how late it is,
+  // returns false if nothing is due.
+  bool peek_next_request(const uint32_t now, dtouch_request *request, uint32_t *overdue);
+  // Called by the bus when it sends a request obtained from peek_next_request
+  void start_request(const dtouch_request &request, const uint32_t now);
+  // Time in ms until the next command is due, UINT32_MAX if the device has no commands
+  uint32_t time_until_due(const uint32_t now) const;
+  // Called by the bus with a checksum-verified response to the last request of this device
+  void handle_response(const dtouch_request &request, const uint8_t *response, const size_t len);
+  // Called by the bus when the last request of this device was dropped after all retries
+  void handle_failure(const dtouch_request &request);
 
-  std::queue<sensor_update> publish_queue_;
+ protected:
+  // Applies the publish filter of the slot, then queues the value
+  void publish_slot_(dtouch_slot &slot, float value);
+  void queue_publish_(sensor::Sensor *sensor, float value);
+  void publish_diagnostics_();
+  void complete_request_(const dtouch_request &request, bool success);
+
+  dtouch_slot *sensors_{nullptr};
+  uint8_t num_sensors_{0};
+  dtouch_schedule *commands_{nullptr};
+  uint8_t num_commands_{0};
+
+  // Ring buffer of pending publishes, a sensor is in it at most once so it can never overflow
+  sensor_update *publish_queue_{nullptr};
+  size_t publish_queue_size_{0};
+  size_t publish_queue_head_{0};
+  size_t publish_queue_count_{0};
+  // Time in us loop() may spend publishing before yielding
+  uint32_t publish_budget_{1000};
 
   uint8_t address_;
-  uint32_t update_interval_;
-  unsigned int command_num_ = 0;
-  bool use_command_control_values_;
+
+  CallbackManager<void(const dtouch_command &, bool)> refresh_complete_callback_;
+
+  dtouch_stats stats_{};
+  sensor::Sensor *diagnostic_sensors_[DIAGNOSTIC_COUNT]{};
+};
+
+// Owns the UART and runs one transaction at a time, rotating between the registered devices
+class LOGICA_dTouchBus : public Component, public uart::UARTDevice {
+ public:
+  float get_setup_priority() const override;
+
+  void setup() override;
+  void loop() override;
+  void dump_config() override;
+
+  void register_device(LOGICA_dTouch *device) { devices_.push_back(device); }
+  // Lets an idle bus reconsider the schedule straight away, e.g. after a refresh request
+  void wake();
+  void set_response_timeout(uint32_t response_timeout) { response_timeout_ = response_timeout; }
+  void set_max_retries(uint8_t max_retries) { max_retries_ = max_retries; }
+  // Storage is allocated by codegen, without it nothing is captured
+  void set_capture_buffer(uint8_t *buffer, size_t size) { capture_.set_storage(buffer, size); }
+  // Logs the captured traffic as base64 lines, which concatenated and decoded give a replayable dump
+  void dump_capture();
+
+ protected:
+  void dtouch_send_command_(const uint8_t address, const uint8_t command) {
+    dtouch_send_command_(address, command, nullptr, 0);
+  }
+  void dtouch_send_command_(const uint8_t address, const uint8_t command, const uint8_t *data, const size_t data_len);
+  // Returns true once a checksum-verified frame is in receiver_
+  bool dtouch_receive_packet_();
+  void send_active_request_();
+  // Moves the transaction on after it completed or failed and starts the next one, or sleeps until one is due
+  void advance_();
+
+  std::vector<LOGICA_dTouch *> devices_;
+  // Index of the device that gets the first chance to send once the bus is free
+  size_t next_device_{0};
+
+  TransactionState state_{TRANSACTION_IDLE};
+  // Device and request of the transaction in flight, only valid while not idle
+  LOGICA_dTouch *active_device_{nullptr};
+  dtouch_request active_request_{};
+  uint8_t attempt_{0};
+  bool first_byte_received_{false};
+
+  uint32_t response_timeout_{500};
+  uint8_t max_retries_{2};
+
+  DTouchFrameReceiver receiver_;
+  uint32_t rx_last_read_{0};
+  DTouchCapture capture_;
 
   struct {
+    uint8_t address = 0;
     uint8_t command = 0;
     uint8_t data = 0;
-    unsigned long time = 0;
+    uint32_t time = 0;
   } last_sent_command_;
 };
 
@@ -1,212 +1,379 @@
 import esphome.codegen as cg
 import esphome.config_validation as cv
-from esphome.components import uart, sensor
+from esphome import automation
+from esphome.components import sensor
 from esphome.const import (
     CONF_ADDRESS,
+    CONF_COMMAND,
     CONF_ID,
     CONF_NAME,
     CONF_TEMPERATURE,
+    CONF_TRIGGER_ID,
     CONF_UPDATE_INTERVAL,
     DEVICE_CLASS_MOISTURE,
     DEVICE_CLASS_SPEED,
     DEVICE_CLASS_TEMPERATURE,
     DEVICE_CLASS_WATER,
     DEVICE_CLASS_WIND_SPEED,
+    ENTITY_CATEGORY_DIAGNOSTIC,
     STATE_CLASS_MEASUREMENT,
+    STATE_CLASS_TOTAL_INCREASING,
     UNIT_CELSIUS,
+    UNIT_MILLISECOND,
     UNIT_PERCENT,
 )
 
+from . import CONF_LOGICA_DTOUCH_ID, CONF_RESPONSE_TIMEOUT, LOGICA_dTouchBus, logica_dtouch_ns
+
+CONF_COMMANDS = "commands"
+CONF_CONTROL_VALUES = "control_values"
+CONF_CRC_ERRORS = "crc_errors"
+CONF_DEADBAND = "deadband"
 CONF_EQUILIBRIUM_MOISTURE_CONTENT = "equilibrium_moisture_content"
 CONF_FANS_LEVEL = "fans_level"
 CONF_FINAL_SENSOR = "report_final_value"
+CONF_FIRST_BYTE_LATENCY = "first_byte_latency"
 CONF_FLAPS_LEVEL = "flaps_level"
 CONF_HEATING_LEVEL = "heating_level"
 CONF_IDEAL_SENSOR = "report_ideal_value"
+CONF_MAX_AGE = "max_age"
 CONF_MOISTURE_CONTENT = "moisture_content"
 CONF_NUM_PROBES = "num_probes"
+CONF_ON_REFRESH_COMPLETE = "on_refresh_complete"
+CONF_PUBLISH_BUDGET = "publish_budget"
+CONF_PUBLISH_QUEUE_HIGH_WATER = "publish_queue_high_water"
+CONF_RELATIVE_DEADBAND = "relative_deadband"
+CONF_RESPONSE_LATENCY = "response_latency"
+CONF_RESPONSE_LATENCY_P95 = "response_latency_p95"
+CONF_RESYNCS = "resyncs"
 CONF_SPRAYER_LEVEL = "sprayer_level"
+CONF_TIMEOUTS = "timeouts"
+
+DEPENDENCIES = ["logica_dtouch"]
+
+LOGICA_dTouch = logica_dtouch_ns.class_("LOGICA_dTouch", cg.PollingComponent)
+DiagnosticSensor = logica_dtouch_ns.enum("DiagnosticSensor")
+RefreshAction = logica_dtouch_ns.class_("RefreshAction", automation.Action)
+RefreshCompleteTrigger = logica_dtouch_ns.class_("RefreshCompleteTrigger", automation.Trigger.template(cg.bool_))
+
+LATENCY_SCHEMA = sensor.sensor_schema(
+    unit_of_measurement=UNIT_MILLISECOND,
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_MEASUREMENT,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
+COUNTER_SCHEMA = sensor.sensor_schema(
+    accuracy_decimals=0,
+    state_class=STATE_CLASS_TOTAL_INCREASING,
+    entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+)
 
-DEPENDENCIES = ["uart"]
+DIAGNOSTIC_SENSORS = {
+    CONF_FIRST_BYTE_LATENCY: (DiagnosticSensor.DIAGNOSTIC_FIRST_BYTE_LATENCY, LATENCY_SCHEMA),
+    CONF_RESPONSE_LATENCY: (DiagnosticSensor.DIAGNOSTIC_RESPONSE_LATENCY, LATENCY_SCHEMA),
+    CONF_RESPONSE_LATENCY_P95: (DiagnosticSensor.DIAGNOSTIC_RESPONSE_LATENCY_P95, LATENCY_SCHEMA),
+    CONF_CRC_ERRORS: (DiagnosticSensor.DIAGNOSTIC_CRC_ERRORS, COUNTER_SCHEMA),
+    CONF_TIMEOUTS: (DiagnosticSensor.DIAGNOSTIC_TIMEOUTS, COUNTER_SCHEMA),
+    CONF_RESYNCS: (DiagnosticSensor.DIAGNOSTIC_RESYNCS, COUNTER_SCHEMA),
+    CONF_PUBLISH_QUEUE_HIGH_WATER: (
+        DiagnosticSensor.DIAGNOSTIC_PUBLISH_QUEUE_HIGH_WATER,
+        sensor.sensor_schema(
+            accuracy_decimals=0,
+            state_class=STATE_CLASS_MEASUREMENT,
+            entity_category=ENTITY_CATEGORY_DIAGNOSTIC,
+        ),
+    ),
+}
 
-logica_dtouch_ns = cg.esphome_ns.namespace("logica_dtouch")
-LOGICA_dTouch = logica_dtouch_ns.class_("LOGICA_dTouch", cg.Component, uart.UARTDevice)
+DTOUCH_HEADER_LENGTH = 6
+DTOUCH_CRC_LENGTH = 2
+DTOUCH_MAX_RESPONSE_LENGTH = 128
+DTOUCH_NO_COUNT = 0xFF
+# Slots are indexed by uint8_t
+MAX_SLOTS = 255
+
+# Request data byte of the 'P' command for each sensor group
+MEASUREMENT_COMMANDS = {
+    CONF_MOISTURE_CONTENT: 0x00,
+    CONF_EQUILIBRIUM_MOISTURE_CONTENT: 0x02,
+    CONF_TEMPERATURE: 0x03,
+}
+CONTROL_VALUES_COMMAND = 0x10
+
+# Frame offsets of the 16 bit values in the control values response
+CONTROL_VALUE_OFFSETS = {
+    (CONF_TEMPERATURE, CONF_IDEAL_SENSOR): DTOUCH_HEADER_LENGTH,
+    (CONF_TEMPERATURE, CONF_FINAL_SENSOR): DTOUCH_HEADER_LENGTH + 2,
+    (CONF_EQUILIBRIUM_MOISTURE_CONTENT, CONF_IDEAL_SENSOR): DTOUCH_HEADER_LENGTH + 4,
+    (CONF_EQUILIBRIUM_MOISTURE_CONTENT, CONF_FINAL_SENSOR): DTOUCH_HEADER_LENGTH + 6,
+    (CONF_MOISTURE_CONTENT, CONF_FINAL_SENSOR): DTOUCH_HEADER_LENGTH + 8,
+}
+# Frame offsets of the 8 bit levels in the control values response
+CONTROL_LEVEL_OFFSETS = {
+    CONF_HEATING_LEVEL: DTOUCH_HEADER_LENGTH + 12,
+    CONF_FANS_LEVEL: DTOUCH_HEADER_LENGTH + 13,
+    CONF_FLAPS_LEVEL: DTOUCH_HEADER_LENGTH + 14,
+    CONF_SPRAYER_LEVEL: DTOUCH_HEADER_LENGTH + 15,
+}
+
+COMMANDS = [*MEASUREMENT_COMMANDS, CONF_CONTROL_VALUES]
+
+# Probe values follow the probe count behind the total, each 2 bytes, in a frame of at most
+# DTOUCH_MAX_RESPONSE_LENGTH bytes including the checksum
+PROBES_OFFSET = DTOUCH_HEADER_LENGTH + 3
+MAX_PROBES = (DTOUCH_MAX_RESPONSE_LENGTH - DTOUCH_CRC_LENGTH - PROBES_OFFSET) // 2
+# Command and data byte of the request for each command group
+COMMAND_REQUESTS = {
+    **{group: (ord("P"), data) for group, data in MEASUREMENT_COMMANDS.items()},
+    CONF_CONTROL_VALUES: (ord("P"), CONTROL_VALUES_COMMAND),
+}
+
+# Applied before values are queued, derived sensors (probes, ideal, final) share the filter of their group
+PUBLISH_FILTER_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_DEADBAND, default=0.0): cv.positive_float,
+        cv.Optional(CONF_RELATIVE_DEADBAND, default="0%"): cv.percentage,
+        cv.Optional(CONF_MAX_AGE, default="0ms"): cv.positive_time_period_milliseconds,
+    }
+)
+
+# Poll deadlines are compared as signed 32 bit differences of millis()
+MAX_UPDATE_INTERVAL = cv.TimePeriod(milliseconds=2**31 - 1)
+
+COMMAND_SCHEMA = cv.Schema(
+    {
+        cv.Optional(CONF_RESPONSE_TIMEOUT): cv.positive_time_period_milliseconds,
+        cv.Optional(CONF_UPDATE_INTERVAL): cv.All(
+            cv.positive_time_period_milliseconds, cv.Range(max=MAX_UPDATE_INTERVAL)
+        ),
+    }
+)
 
 CONFIG_SCHEMA = (
     cv.Schema(
         {
             cv.GenerateID(): cv.declare_id(LOGICA_dTouch),
+            cv.GenerateID(CONF_LOGICA_DTOUCH_ID): cv.use_id(LOGICA_dTouchBus),
             cv.Optional(CONF_TEMPERATURE): sensor.sensor_schema(
                 unit_of_measurement=UNIT_CELSIUS,
                 accuracy_decimals=1,
                 device_class=DEVICE_CLASS_TEMPERATURE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ).extend(cv.Schema({
-                cv.Required(CONF_NUM_PROBES): cv.int_range(min=0),
+                cv.Required(CONF_NUM_PROBES): cv.int_range(min=0, max=MAX_PROBES),
                 cv.Optional(CONF_IDEAL_SENSOR, default=False): cv.boolean,
                 cv.Optional(CONF_FINAL_SENSOR, default=False): cv.boolean,
-            })),
+            })).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_MOISTURE_CONTENT): sensor.sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 accuracy_decimals=1,
                 device_class=DEVICE_CLASS_MOISTURE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ).extend(cv.Schema({
-                cv.Required(CONF_NUM_PROBES): cv.int_range(min=0),
+                cv.Required(CONF_NUM_PROBES): cv.int_range(min=0, max=MAX_PROBES),
                 cv.Optional(CONF_FINAL_SENSOR, default=False): cv.boolean,
-            })),
+            })).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_EQUILIBRIUM_MOISTURE_CONTENT): sensor.sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 accuracy_decimals=1,
                 device_class=DEVICE_CLASS_MOISTURE,
                 state_class=STATE_CLASS_MEASUREMENT,
             ).extend(cv.Schema({
-                cv.Required(CONF_NUM_PROBES): cv.int_range(min=0),
+                cv.Required(CONF_NUM_PROBES): cv.int_range(min=0, max=MAX_PROBES),
                 cv.Optional(CONF_IDEAL_SENSOR, default=False): cv.boolean,
                 cv.Optional(CONF_FINAL_SENSOR, default=False): cv.boolean,
-            })),
+            })).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_HEATING_LEVEL): sensor.sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_TEMPERATURE,
                 state_class=STATE_CLASS_MEASUREMENT,
-            ),
+            ).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_FANS_LEVEL): sensor.sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_SPEED,
                 state_class=STATE_CLASS_MEASUREMENT,
-            ),
+            ).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_FLAPS_LEVEL): sensor.sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_WIND_SPEED,
                 state_class=STATE_CLASS_MEASUREMENT,
-            ),
+            ).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_SPRAYER_LEVEL): sensor.sensor_schema(
                 unit_of_measurement=UNIT_PERCENT,
                 accuracy_decimals=0,
                 device_class=DEVICE_CLASS_WATER,
                 state_class=STATE_CLASS_MEASUREMENT,
-            ),
+            ).extend(PUBLISH_FILTER_SCHEMA),
             cv.Optional(CONF_ADDRESS, default=1): cv.int_range(min=1, max=254),
-            cv.Optional(CONF_UPDATE_INTERVAL, default="5s"): cv.update_interval,
+            cv.Optional(CONF_PUBLISH_BUDGET, default="1000us"): cv.positive_time_period_microseconds,
+            cv.Optional(CONF_COMMANDS, default={}): cv.Schema(
+                {cv.Optional(command): COMMAND_SCHEMA for command in COMMANDS}
+            ),
+            cv.Optional(CONF_ON_REFRESH_COMPLETE): automation.validate_automation(
+                {
+                    cv.GenerateID(CONF_TRIGGER_ID): cv.declare_id(RefreshCompleteTrigger),
+                    cv.Optional(CONF_COMMAND): cv.one_of(*COMMANDS, lower=True),
+                }
+            ),
         }
     )
-    .extend(uart.UART_DEVICE_SCHEMA)
+    .extend({cv.Optional(key): schema for key, (_, schema) in DIAGNOSTIC_SENSORS.items()})
+    .extend(cv.polling_component_schema("5s"))
 )
 
 
+def validate_slot_count(config):
+    slots = 0
+    for group in MEASUREMENT_COMMANDS:
+        if group in config:
+            group_config = config[group]
+            slots += 1 + group_config[CONF_NUM_PROBES]
+            slots += group_config.get(CONF_IDEAL_SENSOR, False) + group_config.get(CONF_FINAL_SENSOR, False)
+    slots += sum(1 for level in CONTROL_LEVEL_OFFSETS if level in config)
+    if slots > MAX_SLOTS:
+        raise cv.Invalid(f"A device supports at most {MAX_SLOTS} sensors, {slots} are configured")
+    return config
+
+
+def validate_update_interval(config):
+    # never, i.e. SCHEDULER_DONT_RUN, only polls on refresh
+    interval = config[CONF_UPDATE_INTERVAL]
+    if isinstance(interval, cv.TimePeriod) and interval > MAX_UPDATE_INTERVAL:
+        raise cv.Invalid(
+            f"'{CONF_UPDATE_INTERVAL}' must be 'never' or at most {MAX_UPDATE_INTERVAL}"
+        )
+    return config
+
+
+CONFIG_SCHEMA = cv.All(CONFIG_SCHEMA, validate_slot_count, validate_update_interval)
+
+
+def field(offset, width, mask, scale, slot, count_offset=DTOUCH_NO_COUNT, index=0):
+    return f"{{{offset}, {width}, 0x{mask:04X}, {scale}f, {slot}, {count_offset}, {index}}}"
+
+
+async def new_derived_sensor(config, id_suffix, name_suffix):
+    custom_conf = config.copy()
+    custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
+    custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + id_suffix
+    custom_conf[CONF_NAME] = config[CONF_NAME] + name_suffix
+    return await sensor.new_sensor(custom_conf)
+
+
 async def to_code(config):
     var = cg.new_Pvariable(config[CONF_ID])
     await cg.register_component(var, config)
-    await uart.register_uart_device(var, config)
-
-    if CONF_MOISTURE_CONTENT in config:
-        sens = await sensor.new_sensor(config[CONF_MOISTURE_CONTENT])
-        cg.add(var.set_mc_sensor(sens))
-        cg.add(var.add_command())
-        for idx in range(0, config[CONF_MOISTURE_CONTENT][CONF_NUM_PROBES]):
-            custom_conf = config[CONF_MOISTURE_CONTENT].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_probe_" + str(idx+1)
-            custom_conf[CONF_NAME] = config[CONF_MOISTURE_CONTENT][CONF_NAME] + " " + str(idx+1)
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.add_mc_probe(sens))
-        
-        if config[CONF_MOISTURE_CONTENT][CONF_FINAL_SENSOR]:
-            custom_conf = config[CONF_MOISTURE_CONTENT].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_final"
-            custom_conf[CONF_NAME] = config[CONF_MOISTURE_CONTENT][CONF_NAME] + " final"
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.set_mc_sensor_final(sens))
-
-    if CONF_EQUILIBRIUM_MOISTURE_CONTENT in config:
-        sens = await sensor.new_sensor(config[CONF_EQUILIBRIUM_MOISTURE_CONTENT])
-        cg.add(var.set_emc_sensor(sens))
-        cg.add(var.add_command())
-        
-        for idx in range(0, config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_NUM_PROBES]):
-            custom_conf = config[CONF_EQUILIBRIUM_MOISTURE_CONTENT].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_probe_" + str(idx+1)
-            custom_conf[CONF_NAME] = config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_NAME] + " " + str(idx+1)
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.add_emc_probe(sens))
-        
-        if config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_IDEAL_SENSOR]:
-            custom_conf = config[CONF_EQUILIBRIUM_MOISTURE_CONTENT].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_ideal"
-            custom_conf[CONF_NAME] = config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_NAME] + " ideal"
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.set_emc_sensor_ideal(sens))
-        
-        if config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_FINAL_SENSOR]:
-            custom_conf = config[CONF_EQUILIBRIUM_MOISTURE_CONTENT].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_final"
-            custom_conf[CONF_NAME] = config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_NAME] + " final"
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.set_emc_sensor_final(sens))
-
-    if CONF_TEMPERATURE in config:
-        sens = await sensor.new_sensor(config[CONF_TEMPERATURE])
-        cg.add(var.set_temperature_sensor(sens))
-        cg.add(var.add_command())
-        for idx in range(0, config[CONF_TEMPERATURE][CONF_NUM_PROBES]):
-            custom_conf = config[CONF_TEMPERATURE].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_probe_" + str(idx+1)
-            custom_conf[CONF_NAME] = config[CONF_TEMPERATURE][CONF_NAME] + " " + str(idx+1)
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.add_temperature_probe(sens))
-        
-        if config[CONF_TEMPERATURE][CONF_IDEAL_SENSOR]:
-            custom_conf = config[CONF_TEMPERATURE].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_ideal"
-            custom_conf[CONF_NAME] = config[CONF_TEMPERATURE][CONF_NAME] + " ideal"
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.set_temperature_sensor_ideal(sens))
-        
-        if config[CONF_TEMPERATURE][CONF_FINAL_SENSOR]:
-            custom_conf = config[CONF_TEMPERATURE].copy()
-            custom_conf[CONF_ID] = custom_conf[CONF_ID].copy()
-            custom_conf[CONF_ID].id = custom_conf[CONF_ID].id + "_final"
-            custom_conf[CONF_NAME] = config[CONF_TEMPERATURE][CONF_NAME] + " final"
-            sens = await sensor.new_sensor(custom_conf)
-            cg.add(var.set_temperature_sensor_final(sens))
-
-    if CONF_HEATING_LEVEL in config:
-        sens = await sensor.new_sensor(config[CONF_HEATING_LEVEL])
-        cg.add(var.set_heating_sensor(sens))
-    
-    if CONF_FANS_LEVEL in config:
-        sens = await sensor.new_sensor(config[CONF_FANS_LEVEL])
-        cg.add(var.set_fans_sensor(sens))
-    
-    if CONF_FLAPS_LEVEL in config:
-        sens = await sensor.new_sensor(config[CONF_FLAPS_LEVEL])
-        cg.add(var.set_flaps_sensor(sens))
-    
-    if CONF_SPRAYER_LEVEL in config:
-        sens = await sensor.new_sensor(config[CONF_SPRAYER_LEVEL])
-        cg.add(var.set_sprayer_sensor(sens))
-
-    if (
-        config[CONF_TEMPERATURE][CONF_IDEAL_SENSOR] or
-        config[CONF_TEMPERATURE][CONF_FINAL_SENSOR] or
-        config[CONF_MOISTURE_CONTENT][CONF_FINAL_SENSOR] or
-        config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_IDEAL_SENSOR] or
-        config[CONF_EQUILIBRIUM_MOISTURE_CONTENT][CONF_FINAL_SENSOR] or
-        CONF_HEATING_LEVEL in config or
-        CONF_FANS_LEVEL in config or
-        CONF_FLAPS_LEVEL in config or
-        CONF_SPRAYER_LEVEL in config
-    ):
-        var.add_command()
+    parent = await cg.get_variable(config[CONF_LOGICA_DTOUCH_ID])
+    cg.add(var.set_parent(parent))
+    cg.add(parent.register_device(var))
+
+    slots = []
+
+    def add_sensor(sens, filter_config):
+        slots.append(
+            (
+                sens,
+                filter_config[CONF_DEADBAND],
+                filter_config[CONF_RELATIVE_DEADBAND],
+                filter_config[CONF_MAX_AGE],
+            )
+        )
+        return len(slots) - 1
+
+    layouts = {}
+    for group, data in MEASUREMENT_COMMANDS.items():
+        if group not in config:
+            continue
+        group_config = config[group]
+        # Total value, followed by the number of probes and the probe values
+        sens = await sensor.new_sensor(group_config)
+        fields = [field(DTOUCH_HEADER_LENGTH, 2, 0xFFFF, 0.1, add_sensor(sens, group_config))]
+        count_offset = DTOUCH_HEADER_LENGTH + 2
+        for idx in range(0, group_config[CONF_NUM_PROBES]):
+            sens = await new_derived_sensor(group_config, "_probe_" + str(idx+1), " " + str(idx+1))
+            offset = PROBES_OFFSET + 2 * idx
+            fields.append(field(offset, 2, 0x0FFF, 0.1, add_sensor(sens, group_config), count_offset, idx))
+        layouts[group] = (data, fields)
+
+    fields = []
+    for (group, kind), offset in CONTROL_VALUE_OFFSETS.items():
+        if group not in config or not config[group].get(kind, False):
+            continue
+        suffix = "ideal" if kind == CONF_IDEAL_SENSOR else "final"
+        sens = await new_derived_sensor(config[group], "_" + suffix, " " + suffix)
+        fields.append(field(offset, 2, 0xFFFF, 0.1, add_sensor(sens, config[group])))
+    for level, offset in CONTROL_LEVEL_OFFSETS.items():
+        if level not in config:
+            continue
+        sens = await sensor.new_sensor(config[level])
+        fields.append(field(offset, 1, 0x00FF, 1.0, add_sensor(sens, config[level])))
+    if fields:
+        layouts[CONF_CONTROL_VALUES] = (CONTROL_VALUES_COMMAND, fields)
+
+    # The tables are sized here, so the device allocates nothing at boot. Sensor pointers only exist once
+    # the generated setup code has run, so the slots are filled in from there.
+    if slots:
+        table = f"{config[CONF_ID].id}_sensors"
+        cg.add_global(cg.RawStatement(f"static logica_dtouch::dtouch_slot {table}[{len(slots)}];"))
+        cg.add(var.set_sensors(cg.RawExpression(table), len(slots)))
+        for slot, (sens, deadband, relative_deadband, max_age) in enumerate(slots):
+            cg.add(var.set_sensor(slot, sens, deadband, relative_deadband, max_age))
+
+    schedules = []
+    for command, (data, fields) in layouts.items():
+        layout = f"{config[CONF_ID].id}_layout_{command}"
+        cg.add_global(
+            cg.RawStatement(f"static const logica_dtouch::dtouch_field {layout}[] = {{{', '.join(fields)}}};")
+        )
+        command_config = config[CONF_COMMANDS].get(command, {})
+        # 0 falls back to the bus response timeout and the device update interval
+        timeout = command_config.get(CONF_RESPONSE_TIMEOUT, cv.TimePeriod()).total_milliseconds
+        interval = command_config.get(CONF_UPDATE_INTERVAL, cv.TimePeriod()).total_milliseconds
+        schedules.append(f"{{{{{ord('P')}, {data}, {layout}, {len(fields)}, {timeout}}}, {interval}, 0, false, false}}")
+    if schedules:
+        table = f"{config[CONF_ID].id}_commands"
+        cg.add_global(
+            cg.RawStatement(f"static logica_dtouch::dtouch_schedule {table}[] = {{{', '.join(schedules)}}};")
+        )
+        cg.add(var.set_commands(cg.RawExpression(table), len(schedules)))
+
+    for key, (diagnostic, _) in DIAGNOSTIC_SENSORS.items():
+        if key in config:
+            sens = await sensor.new_sensor(config[key])
+            cg.add(var.set_diagnostic_sensor(diagnostic, sens))
 
     cg.add(var.set_address(config[CONF_ADDRESS]))
-    cg.add(var.set_update_interval(config[CONF_UPDATE_INTERVAL]))
\ No newline at end of file
+    cg.add(var.set_publish_budget(config[CONF_PUBLISH_BUDGET]))
+
+    # Each sensor is queued at most once, so one slot per sensor is enough
+    queue_size = max(len(slots), 1)
+    queue = f"{config[CONF_ID].id}_publish_queue"
+    cg.add_global(cg.RawStatement(f"static logica_dtouch::sensor_update {queue}[{queue_size}];"))
+    cg.add(var.set_publish_queue(cg.RawExpression(queue), queue_size))
+
+    for conf in config.get(CONF_ON_REFRESH_COMPLETE, []):
+        trigger = cg.new_Pvariable(conf[CONF_TRIGGER_ID], var)
+        if CONF_COMMAND in conf:
+            cg.add(trigger.set_command(*COMMAND_REQUESTS[conf[CONF_COMMAND]]))
+        await automation.build_automation(trigger, [(bool, "x")], conf)
+
+
+@automation.register_action(
+    "logica_dtouch.refresh",
+    RefreshAction,
+    cv.Schema(
+        {
+            cv.GenerateID(): cv.use_id(LOGICA_dTouch),
+            cv.Optional(CONF_COMMAND): cv.one_of(*COMMANDS, lower=True),
+        }
+    ),
+)
+async def refresh_to_code(config, action_id, template_arg, args):
+    var = cg.new_Pvariable(action_id, template_arg)
+    await cg.register_parented(var, config[CONF_ID])
+    if CONF_COMMAND in config:
+        cg.add(var.set_command(*COMMAND_REQUESTS[config[CONF_COMMAND]]))
+    return var
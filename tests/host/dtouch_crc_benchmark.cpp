@@ -0,0 +1,75 @@
+// Compares the nibble-table CRC-16/MODBUS of dtouch_protocol.cpp against the bitwise loop it replaced, on
+// 128 byte frames: first for equality over random frames, then for speed. Exits non-zero on any mismatch.
+
+#include "logica_dtouch/dtouch_protocol.h"
+
+#include <chrono>
+#include <cstdio>
+#include <random>
+
+using namespace esphome::logica_dtouch;
+
+static const size_t FRAME_LENGTH = DTOUCH_MAX_RESPONSE_LENGTH;
+static const size_t CHECK_FRAMES = 100000;
+static const size_t BENCHMARK_FRAMES = 200000;
+
+// The implementation before the table, 8 shift/xor steps per byte
+static uint16_t crc_bitwise(const uint8_t *bytes, size_t len, uint16_t crc) {
+  for (size_t i = 0; i < len; i++) {
+    crc ^= bytes[i];
+    for (uint8_t j = 0; j < 8; j++)
+      crc = (crc & 0x0001) ? (crc >> 1) ^ 0xA001 : crc >> 1;
+  }
+  return crc;
+}
+
+// ns per frame, sink keeps the results alive
+template<typename F> static double time_frames(const uint8_t *frames, size_t count, F &&crc, uint32_t *sink) {
+  const auto start = std::chrono::steady_clock::now();
+  for (size_t i = 0; i < BENCHMARK_FRAMES; i++)
+    *sink += crc(frames + (i % count) * FRAME_LENGTH);
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  return std::chrono::duration<double, std::nano>(elapsed).count() / BENCHMARK_FRAMES;
+}
+
+int main() {
+  std::mt19937 rng(0x4454);
+  uint8_t frame[FRAME_LENGTH];
+  for (size_t i = 0; i < CHECK_FRAMES; i++) {
+    const size_t len = rng() % (FRAME_LENGTH + 1);
+    for (size_t j = 0; j < len; j++)
+      frame[j] = rng();
+    const uint16_t expected = crc_bitwise(frame, len, 0xFFFF);
+    // Whole buffer at once and byte by byte as the receiver feeds it
+    uint16_t incremental = 0xFFFF;
+    for (size_t j = 0; j < len; j++)
+      incremental = dtouch_crc(frame[j], incremental);
+    if (dtouch_crc(frame, len) != expected || incremental != expected) {
+      printf("CRC mismatch on a %zu byte frame: table 0x%04X, incremental 0x%04X, bitwise 0x%04X\n", len,
+             dtouch_crc(frame, len), incremental, expected);
+      return 1;
+    }
+  }
+  printf("%zu random frames: table, incremental and bitwise CRC agree\n", CHECK_FRAMES);
+
+  static uint8_t frames[64 * FRAME_LENGTH];
+  for (auto &byte : frames)
+    byte = rng();
+  uint32_t sink = 0;
+  const double bitwise =
+      time_frames(frames, 64, [](const uint8_t *f) { return crc_bitwise(f, FRAME_LENGTH, 0xFFFF); }, &sink);
+  const double table = time_frames(frames, 64, [](const uint8_t *f) { return dtouch_crc(f, FRAME_LENGTH); }, &sink);
+  uint16_t state = 0xFFFF;
+  const double incremental = time_frames(
+      frames, 64,
+      [&state](const uint8_t *f) {
+        state = 0xFFFF;
+        for (size_t j = 0; j < FRAME_LENGTH; j++)
+          state = dtouch_crc(f[j], state);
+        return state;
+      },
+      &sink);
+  printf("%zu byte frames, ns per frame: bitwise %.0f, table %.0f (%.1fx), table byte by byte %.0f (sink %u)\n",
+         FRAME_LENGTH, bitwise, table, bitwise / table, incremental, (unsigned) (sink & 0xF));
+  return 0;
+}
@@ -0,0 +1,673 @@
+// Runs the real LOGICA_dTouchBus and LOGICA_dTouch against a simulated UART, on a simulated clock.
+//
+// Simulation: a controller answers P 0x00/0x02/0x03/0x10 for every configured device with fresh values, after a
+// configurable latency and jitter, at the byte timing of 57600 8E1. Responses can be corrupted (one bit flipped) or
+// lose bytes. Every published value is checked against what the controller actually sent, any mismatch fails the run.
+//
+// Replay: a capture dump of the bus (logica_dtouch.dump_capture, either the log lines or the decoded bytes) is fed
+// back. Each request the bus sends is answered with the bytes recorded after the same request, at the recorded
+// offsets.
+//
+// Both report transactions per second, publish latency and the CPU time the bus spends per frame.
+
+#include "host_runtime.h"
+#include "logica_dtouch/logica_dtouch.h"
+
+#include <algorithm>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <fstream>
+#include <map>
+#include <memory>
+#include <random>
+#include <sstream>
+#include <string>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::logica_dtouch;
+
+// 57600 baud, 8 data bits, even parity, 1 stop bit
+static const double BYTE_TIME_US = 11 * 1e6 / 57600;
+static const uint8_t MEASUREMENT_COMMANDS[] = {0x00, 0x02, 0x03};
+static const uint8_t CONTROL_VALUES_COMMAND = 0x10;
+static const size_t CONTROL_VALUES = 5;
+static const size_t CONTROL_LEVELS = 4;
+static const size_t CAPTURE_SIZE = 65535;
+
+struct Options {
+  uint32_t devices = 2;
+  uint32_t probes = 4;
+  uint32_t seconds = 600;
+  // 0 is update_interval: never, the devices only poll on refresh
+  uint32_t poll_interval_ms = 5000;
+  // Refreshes every device this often, 0 never
+  uint32_t refresh_interval_ms = 0;
+  uint32_t response_timeout_ms = 500;
+  uint32_t max_retries = 2;
+  uint32_t latency_ms = 20;
+  uint32_t jitter_ms = 10;
+  double crc_error_rate = 0.0;
+  double drop_rate = 0.0;
+  double noise_rate = 0.0;
+  double oversize_rate = 0.0;
+  uint32_t loop_ms = 16;
+  uint32_t seed = 1;
+  std::string record;
+  std::string replay;
+  bool verbose = false;
+};
+
+// Where the value of a sensor sits in the response to its command, the same tables sensor.py generates
+struct Channel {
+  uint8_t data;
+  dtouch_field field;
+};
+
+// A device as codegen would set it up, with storage for its tables
+struct Device {
+  uint8_t address;
+  LOGICA_dTouch component;
+  std::deque<sensor::Sensor> sensors;
+  std::vector<Channel> channels;
+  std::vector<dtouch_slot> slots;
+  std::map<uint8_t, std::vector<dtouch_field>> layouts;
+  std::vector<dtouch_schedule> schedules;
+  std::vector<sensor_update> queue;
+};
+
+static dtouch_field make_field(uint8_t offset, uint8_t width, uint16_t mask, float scale, uint8_t slot,
+                               uint8_t count_offset = DTOUCH_NO_COUNT, uint8_t index = 0) {
+  return {offset, width, mask, scale, slot, count_offset, index};
+}
+
+static void build_device(Device &device, uint8_t address, uint32_t probes, const Options &options) {
+  device.address = address;
+  auto add_sensor = [&device, address](uint8_t data, const std::string &name, const dtouch_field &field) {
+    device.sensors.emplace_back("device " + std::to_string(address) + " " + name);
+    device.channels.push_back({data, field});
+    device.layouts[data].push_back(field);
+  };
+  for (uint8_t data : MEASUREMENT_COMMANDS) {
+    char group[8];
+    snprintf(group, sizeof(group), "0x%02X", data);
+    const uint8_t count_offset = DTOUCH_HEADER_LENGTH + 2;
+    add_sensor(data, std::string(group) + " total",
+               make_field(DTOUCH_HEADER_LENGTH, 2, 0xFFFF, 0.1f, device.sensors.size()));
+    for (uint32_t i = 0; i < probes; i++)
+      add_sensor(data, std::string(group) + " probe " + std::to_string(i + 1),
+                 make_field(count_offset + 1 + 2 * i, 2, 0x0FFF, 0.1f, device.sensors.size(), count_offset, i));
+  }
+  for (size_t i = 0; i < CONTROL_VALUES; i++)
+    add_sensor(CONTROL_VALUES_COMMAND, "value " + std::to_string(i + 1),
+               make_field(DTOUCH_HEADER_LENGTH + 2 * i, 2, 0xFFFF, 0.1f, device.sensors.size()));
+  for (size_t i = 0; i < CONTROL_LEVELS; i++)
+    add_sensor(CONTROL_VALUES_COMMAND, "level " + std::to_string(i + 1),
+               make_field(DTOUCH_HEADER_LENGTH + 12 + i, 1, 0x00FF, 1.0f, device.sensors.size()));
+
+  device.slots.resize(device.sensors.size());
+  device.component.set_sensors(device.slots.data(), device.slots.size());
+  for (size_t i = 0; i < device.sensors.size(); i++)
+    device.component.set_sensor(i, &device.sensors[i], 0.0f, 0.0f, 0);
+  for (auto &layout : device.layouts) {
+    device.schedules.push_back({{'P', layout.first, layout.second.data(), (uint8_t) layout.second.size(), 0},
+                                0, 0, false, false});
+  }
+  device.component.set_commands(device.schedules.data(), device.schedules.size());
+  device.queue.resize(device.sensors.size());
+  device.component.set_publish_queue(device.queue.data(), device.queue.size());
+  device.component.set_address(address);
+  device.component.set_update_interval(options.poll_interval_ms ? options.poll_interval_ms : SCHEDULER_DONT_RUN);
+}
+
+// Bytes on their way to the bus, each with the time it has fully arrived
+class SimulatedLine : public uart::UARTComponent {
+ public:
+  int available() override {
+    size_t count = 0;
+    while (count < arrivals_.size() && arrivals_[count].time <= host::now_us())
+      count++;
+    return count;
+  }
+  bool read_array(uint8_t *data, size_t len) override {
+    if ((size_t) this->available() < len)
+      return false;
+    for (size_t i = 0; i < len; i++) {
+      data[i] = arrivals_.front().byte;
+      arrivals_.pop_front();
+    }
+    return true;
+  }
+
+ protected:
+  struct Arrival {
+    uint64_t time;
+    uint8_t byte;
+  };
+  // A new request makes the device abandon whatever it had not sent yet
+  void abort_pending_() {
+    while (!arrivals_.empty() && arrivals_.back().time > host::now_us())
+      arrivals_.pop_back();
+  }
+  void send_(uint64_t start, const uint8_t *bytes, size_t len, const std::vector<bool> &dropped) {
+    for (size_t i = 0; i < len; i++) {
+      if (!dropped[i])
+        arrivals_.push_back({start + (uint64_t) std::llround((i + 1) * BYTE_TIME_US), bytes[i]});
+    }
+  }
+
+  std::deque<Arrival> arrivals_;
+};
+
+// The controllers of all simulated devices sharing the line
+class SimulatedController : public SimulatedLine {
+ public:
+  SimulatedController(const Options &options, std::vector<std::unique_ptr<Device>> &devices)
+      : options_(options), devices_(devices), rng_(options.seed) {}
+
+  void write_array(const uint8_t *frame, size_t len) override {
+    this->commit_();
+    this->abort_pending_();
+    pending_.reset();
+    requests++;
+    // Address, 0x80 0x00 0x00, payload length, command, data, CRC
+    if (len != DTOUCH_HEADER_LENGTH + 2 + DTOUCH_CRC_LENGTH || dtouch_crc(frame, len) != 0) {
+      malformed_requests++;
+      return;
+    }
+    Device *device = this->find_(frame[0]);
+    const uint8_t command = frame[DTOUCH_HEADER_LENGTH], data = frame[DTOUCH_HEADER_LENGTH + 1];
+    if (device == nullptr || command != 'P' || device->layouts.count(data) == 0) {
+      unanswerable_requests++;
+      return;
+    }
+
+    // A retry keeps the time of the first attempt, latency is measured from the poll
+    const auto key = std::make_pair(device->address, data);
+    if (!first_request_.count(key))
+      first_request_[key] = host::now_us();
+
+    std::vector<uint8_t> response = this->build_response_(*device, data);
+    const size_t response_len = response.size();
+    std::uniform_real_distribution<double> unit(0.0, 1.0);
+    bool clean = true;
+    if (unit(rng_) < options_.crc_error_rate) {
+      response[rng_() % response_len] ^= 1 << (rng_() % 8);
+      corrupted_responses++;
+      clean = false;
+    }
+    std::vector<bool> dropped(response_len, false);
+    for (size_t i = 0; i < response_len; i++) {
+      if (unit(rng_) < options_.drop_rate) {
+        dropped[i] = true;
+        clean = false;
+      }
+    }
+    if (!clean && std::find(dropped.begin(), dropped.end(), true) != dropped.end())
+      truncated_responses++;
+
+    // Garbage ahead of the response starts a frame at the polled address, the bus has to drop it and still
+    // find the response behind it
+    std::vector<uint8_t> garbage;
+    if (unit(rng_) < options_.noise_rate) {
+      // An empty payload, followed by more noise than fits a frame
+      garbage = {device->address, 0x80, 0x00, 0x00, 0x00, 0x00};
+      this->add_noise_(&garbage, device->address, 2 * DTOUCH_MAX_RESPONSE_LENGTH);
+      noise_bursts++;
+    }
+    if (unit(rng_) < options_.oversize_rate) {
+      // A frame announcing one byte more payload than the buffer holds, the bus gives up on it at the length
+      const size_t payload = DTOUCH_MAX_RESPONSE_LENGTH - DTOUCH_HEADER_LENGTH - DTOUCH_CRC_LENGTH + 1;
+      garbage.insert(garbage.end(), {device->address, 0x80, 0x00, 0x00, (uint8_t) (payload >> 8), (uint8_t) payload});
+      this->add_noise_(&garbage, device->address, payload + DTOUCH_CRC_LENGTH);
+      oversized_frames++;
+    }
+
+    const uint64_t start =
+        host::now_us() + (options_.latency_ms + (options_.jitter_ms ? rng_() % (options_.jitter_ms + 1) : 0)) * 1000ULL;
+    this->send_(start, garbage.data(), garbage.size(), std::vector<bool>(garbage.size(), false));
+    const uint64_t response_start = start + (uint64_t) std::llround(garbage.size() * BYTE_TIME_US);
+    this->send_(response_start, response.data(), response_len, dropped);
+    if (clean)
+      pending_.reset(new Pending{response_start + (uint64_t) std::llround(response_len * BYTE_TIME_US), key, values_});
+  }
+
+  int available() override {
+    this->commit_();
+    return SimulatedLine::available();
+  }
+
+  // What the controller last sent for a sensor and when the poll that asked for it started
+  struct Truth {
+    float value;
+    uint64_t requested;
+    bool valid;
+  };
+  const Truth &truth(const sensor::Sensor *sensor) { return truth_[sensor]; }
+
+  uint32_t requests{0};
+  uint32_t malformed_requests{0};
+  uint32_t unanswerable_requests{0};
+  uint32_t corrupted_responses{0};
+  uint32_t truncated_responses{0};
+  uint32_t delivered_responses{0};
+  uint32_t noise_bursts{0};
+  uint32_t oversized_frames{0};
+
+ protected:
+  struct Pending {
+    uint64_t complete;
+    std::pair<uint8_t, uint8_t> key;
+    std::map<const sensor::Sensor *, float> values;
+  };
+
+  Device *find_(uint8_t address) {
+    for (auto &device : devices_) {
+      if (device->address == address)
+        return device.get();
+    }
+    return nullptr;
+  }
+
+  std::vector<uint8_t> build_response_(Device &device, uint8_t data) {
+    // Header first, the payload length is filled in once the payload is complete
+    std::vector<uint8_t> frame = {device.address, 0x80, 0x00, 0x00, 0x00, 0x00};
+    values_.clear();
+    auto put_value = [this, &frame, &device](uint8_t width, uint16_t raw, size_t channel) {
+      const dtouch_field &field = device.channels[channel].field;
+      if (width == 2)
+        frame.push_back(raw >> 8);
+      frame.push_back(raw);
+      values_[&device.sensors[channel]] = (raw & field.mask) * field.scale;
+    };
+    size_t channel = 0;
+    while (device.channels[channel].data != data)
+      channel++;
+    if (data == CONTROL_VALUES_COMMAND) {
+      for (size_t i = 0; i < CONTROL_VALUES; i++)
+        put_value(2, rng_() % 1200, channel++);
+      frame.push_back(0);
+      frame.push_back(0);
+      for (size_t i = 0; i < CONTROL_LEVELS; i++)
+        put_value(1, rng_() % 101, channel++);
+    } else {
+      put_value(2, rng_() % 1000, channel++);
+      frame.push_back(options_.probes);
+      // The top nibble of probe values carries flags, the layout masks them off
+      for (uint32_t i = 0; i < options_.probes; i++)
+        put_value(2, rng_() % 0x10000, channel++);
+    }
+
+    const size_t payload_len = frame.size() - DTOUCH_HEADER_LENGTH;
+    frame[4] = payload_len >> 8;
+    frame[5] = payload_len;
+    const uint16_t crc = dtouch_crc(frame.data(), frame.size());
+    frame.push_back(crc);
+    frame.push_back(crc >> 8);
+    return frame;
+  }
+
+  // Random bytes that never start a frame at the address, so they cannot pass for a response by chance
+  void add_noise_(std::vector<uint8_t> *bytes, uint8_t address, size_t count) {
+    for (size_t i = 0; i < count; i++) {
+      uint8_t byte;
+      do {
+        byte = rng_();
+      } while (byte == address);
+      bytes->push_back(byte);
+    }
+  }
+
+  // Once the last byte of a clean response is on the line, its values are what the bus should publish
+  void commit_() {
+    if (!pending_ || pending_->complete > host::now_us())
+      return;
+    const uint64_t requested = first_request_[pending_->key];
+    for (const auto &value : pending_->values)
+      truth_[value.first] = {value.second, requested, true};
+    first_request_.erase(pending_->key);
+    delivered_responses++;
+    pending_.reset();
+  }
+
+  const Options &options_;
+  std::vector<std::unique_ptr<Device>> &devices_;
+  std::mt19937 rng_;
+  std::map<const sensor::Sensor *, float> values_;
+  std::unique_ptr<Pending> pending_;
+  std::map<std::pair<uint8_t, uint8_t>, uint64_t> first_request_;
+  std::map<const sensor::Sensor *, Truth> truth_;
+};
+
+// Answers each request with the bytes recorded after the same request in a capture
+class ReplayController : public SimulatedLine {
+ public:
+  bool load(const std::vector<uint8_t> &dump) {
+    size_t pos = 0;
+    dtouch_capture_record record;
+    while (dtouch_capture_parse(dump.data(), dump.size(), &pos, &record)) {
+      if (record.type == DTOUCH_CAPTURE_TX) {
+        transactions_.push_back({std::vector<uint8_t>(record.bytes, record.bytes + record.length), record.time, {}});
+      } else if (record.type == DTOUCH_CAPTURE_RX && !transactions_.empty()) {
+        transactions_.back().rx.push_back(
+            {record.time - transactions_.back().time, std::vector<uint8_t>(record.bytes, record.bytes + record.length)});
+      }
+    }
+    return pos == dump.size() && !transactions_.empty();
+  }
+
+  void write_array(const uint8_t *frame, size_t len) override {
+    this->abort_pending_();
+    requests++;
+    const std::vector<uint8_t> request(frame, frame + len);
+    // The bus may order requests differently than in the recording, take the next one that matches
+    for (size_t i = cursor_; i < transactions_.size(); i++) {
+      if (transactions_[i].used || transactions_[i].tx != request)
+        continue;
+      transactions_[i].used = true;
+      replayed++;
+      for (const auto &chunk : transactions_[i].rx) {
+        const std::vector<bool> dropped(chunk.bytes.size(), false);
+        // Recorded times are when the chunk was read, which is after its last byte arrived
+        const uint64_t end = host::now_us() + chunk.offset_ms * 1000ULL;
+        const uint64_t duration = (uint64_t) std::llround(chunk.bytes.size() * BYTE_TIME_US);
+        this->send_(end > duration ? end - duration : 0, chunk.bytes.data(), chunk.bytes.size(), dropped);
+      }
+      while (cursor_ < transactions_.size() && transactions_[cursor_].used)
+        cursor_++;
+      return;
+    }
+    unmatched++;
+  }
+
+  bool exhausted() const { return cursor_ == transactions_.size(); }
+  size_t size() const { return transactions_.size(); }
+
+  uint32_t requests{0};
+  uint32_t replayed{0};
+  uint32_t unmatched{0};
+
+ protected:
+  struct Chunk {
+    uint32_t offset_ms;
+    std::vector<uint8_t> bytes;
+  };
+  struct Transaction {
+    std::vector<uint8_t> tx;
+    uint32_t time;
+    std::vector<Chunk> rx;
+    bool used{false};
+  };
+
+  std::vector<Transaction> transactions_;
+  size_t cursor_{0};
+};
+
+// Accepts the decoded dump or the log lines of dump_capture
+static bool read_dump(const std::string &path, std::vector<uint8_t> *dump) {
+  std::ifstream file(path, std::ios::binary);
+  if (!file)
+    return false;
+  std::string contents((std::istreambuf_iterator<char>(file)), std::istreambuf_iterator<char>());
+  if (contents.compare(0, sizeof(DTOUCH_CAPTURE_MAGIC), (const char *) DTOUCH_CAPTURE_MAGIC,
+                       sizeof(DTOUCH_CAPTURE_MAGIC)) == 0) {
+    dump->assign(contents.begin(), contents.end());
+    return true;
+  }
+  // The last word of every line after "Capture:" is a base64 chunk
+  std::istringstream lines(contents);
+  std::string line, encoded;
+  bool in_capture = false;
+  while (std::getline(lines, line)) {
+    if (line.find("Capture:") != std::string::npos) {
+      in_capture = true;
+      encoded.clear();
+      continue;
+    }
+    const size_t end = line.find_last_not_of(" \r\n");
+    if (!in_capture || end == std::string::npos)
+      continue;
+    const size_t start = line.find_last_of(' ', end);
+    encoded += line.substr(start == std::string::npos ? 0 : start + 1, end - start);
+  }
+  *dump = base64_decode(encoded);
+  return !dump->empty();
+}
+
+struct LatencyStats {
+  std::vector<double> samples;
+
+  void add(double value) { samples.push_back(value); }
+  double percentile(double percent) {
+    if (samples.empty())
+      return NAN;
+    std::sort(samples.begin(), samples.end());
+    return samples[std::min(samples.size() - 1, (size_t) (percent / 100.0 * samples.size()))];
+  }
+  double mean() const {
+    double sum = 0;
+    for (double sample : samples)
+      sum += sample;
+    return samples.empty() ? NAN : sum / samples.size();
+  }
+};
+
+static bool parse_options(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--verbose") {
+      options->verbose = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    if (arg == "--devices") {
+      options->devices = atoi(value);
+    } else if (arg == "--probes") {
+      options->probes = atoi(value);
+    } else if (arg == "--seconds") {
+      options->seconds = atoi(value);
+    } else if (arg == "--poll-interval-ms") {
+      options->poll_interval_ms = atoi(value);
+    } else if (arg == "--refresh-interval-ms") {
+      options->refresh_interval_ms = atoi(value);
+    } else if (arg == "--response-timeout-ms") {
+      options->response_timeout_ms = atoi(value);
+    } else if (arg == "--max-retries") {
+      options->max_retries = atoi(value);
+    } else if (arg == "--latency-ms") {
+      options->latency_ms = atoi(value);
+    } else if (arg == "--jitter-ms") {
+      options->jitter_ms = atoi(value);
+    } else if (arg == "--crc-error-rate") {
+      options->crc_error_rate = atof(value);
+    } else if (arg == "--drop-rate") {
+      options->drop_rate = atof(value);
+    } else if (arg == "--noise-rate") {
+      options->noise_rate = atof(value);
+    } else if (arg == "--oversize-rate") {
+      options->oversize_rate = atof(value);
+    } else if (arg == "--loop-ms") {
+      options->loop_ms = atoi(value);
+    } else if (arg == "--seed") {
+      options->seed = atoi(value);
+    } else if (arg == "--record") {
+      options->record = value;
+    } else if (arg == "--replay") {
+      options->replay = value;
+    } else {
+      return false;
+    }
+  }
+  return options->devices >= 1 && options->devices <= 254 && options->probes <= 58;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--devices N] [--probes N] [--seconds N] [--poll-interval-ms N] [--refresh-interval-ms N]\n"
+            "          [--response-timeout-ms N] [--max-retries N] [--latency-ms N] [--jitter-ms N]\n"
+            "          [--crc-error-rate P] [--drop-rate P] [--noise-rate P] [--oversize-rate P] [--loop-ms N]\n"
+            "          [--seed N] [--record FILE] [--replay FILE] [--verbose]\n",
+            argv[0]);
+    return 2;
+  }
+  host::log_level = options.verbose ? ESPHOME_LOG_LEVEL_DEBUG : ESPHOME_LOG_LEVEL_ERROR;
+
+  std::vector<std::unique_ptr<Device>> devices;
+  for (uint32_t i = 0; i < options.devices; i++) {
+    devices.emplace_back(new Device());
+    build_device(*devices.back(), i + 1, options.probes, options);
+  }
+
+  LOGICA_dTouchBus bus;
+  SimulatedController controller(options, devices);
+  ReplayController replay;
+  const bool replaying = !options.replay.empty();
+  if (replaying) {
+    std::vector<uint8_t> dump;
+    if (!read_dump(options.replay, &dump) || !replay.load(dump)) {
+      fprintf(stderr, "%s: not a dTouch capture\n", options.replay.c_str());
+      return 2;
+    }
+    bus.set_uart_parent(&replay);
+  } else {
+    bus.set_uart_parent(&controller);
+  }
+  bus.set_response_timeout(options.response_timeout_ms);
+  bus.set_max_retries(options.max_retries);
+  static uint8_t capture[CAPTURE_SIZE];
+  if (!options.record.empty())
+    bus.set_capture_buffer(capture, sizeof(capture));
+
+  host::App.set_loop_tick_us(options.loop_ms * 1000);
+  host::App.add(&bus);
+  for (auto &device : devices) {
+    device->component.set_parent(&bus);
+    bus.register_device(&device->component);
+    host::App.add(&device->component);
+  }
+
+  LatencyStats latency;
+  uint32_t publishes = 0, mismatches = 0, refreshes = 0;
+  for (auto &device : devices) {
+    for (auto &sens : device->sensors) {
+      sensor::Sensor *sensor = &sens;
+      sensor->add_on_state_callback([&, sensor](float value) {
+        publishes++;
+        if (replaying)
+          return;
+        const SimulatedController::Truth &truth = controller.truth(sensor);
+        if (!truth.valid || truth.value != value) {
+          if (mismatches++ < 10)
+            fprintf(stderr, "%s published %.1f, the controller sent %.1f\n", sensor->get_name().c_str(), value,
+                    truth.value);
+          return;
+        }
+        latency.add((host::now_us() - truth.requested) / 1000.0);
+      });
+    }
+  }
+
+  host::App.setup();
+  if (options.verbose)
+    host::App.dump_config();
+  if (replaying) {
+    // Until every recorded transaction was asked for, or the bus stops asking for them
+    uint64_t end = (uint64_t) options.seconds * 1000000;
+    for (uint64_t t = 1000000; t <= end && !replay.exhausted(); t += 1000000)
+      host::App.run_until(t);
+  } else if (options.refresh_interval_ms) {
+    const uint64_t end = (uint64_t) options.seconds * 1000000;
+    for (uint64_t t = options.refresh_interval_ms * 1000ULL; t <= end; t += options.refresh_interval_ms * 1000ULL) {
+      host::App.run_until(t);
+      for (auto &device : devices)
+        device->component.refresh();
+      refreshes++;
+    }
+    host::App.run_until(end);
+  } else {
+    host::App.run_until((uint64_t) options.seconds * 1000000);
+  }
+  const double seconds = host::now_us() / 1e6;
+
+  uint32_t crc_errors = 0, timeouts = 0, resyncs = 0;
+  for (auto &device : devices) {
+    const dtouch_stats &stats = device->component.get_stats();
+    crc_errors += stats.crc_errors;
+    timeouts += stats.timeouts;
+    resyncs += stats.resyncs;
+  }
+  const host::CpuStats loop = host::App.cpu(&bus, "loop");
+  const uint64_t bus_ns = loop.ns + host::App.cpu(&bus, "response").ns + host::App.cpu(&bus, "next_request").ns;
+
+  printf("%.1f s simulated, %u device(s), %u probe(s) per group, loop every %u ms\n", seconds, options.devices,
+         options.probes, options.loop_ms);
+  uint32_t frames;
+  if (replaying) {
+    frames = replay.replayed;
+    printf("replayed %u of %zu recorded transaction(s), %u request(s) had no recording left\n", replay.replayed,
+           replay.size(), replay.unmatched);
+  } else {
+    frames = controller.delivered_responses;
+    printf("%u request(s), %u clean response(s), %u corrupted, %u with dropped bytes, %u unanswered\n",
+           controller.requests, controller.delivered_responses, controller.corrupted_responses,
+           controller.truncated_responses, controller.unanswerable_requests + controller.malformed_requests);
+    if (controller.noise_bursts || controller.oversized_frames)
+      printf("%u noise burst(s), %u oversized frame(s) ahead of responses\n", controller.noise_bursts,
+             controller.oversized_frames);
+  }
+  printf("bus: %.2f transactions/s, %u CRC error(s), %u timeout(s), %u resync(s)\n", frames / seconds, crc_errors,
+         timeouts, resyncs);
+  printf("published %u value(s)", publishes);
+  if (!replaying)
+    printf(", latency from poll: mean %.1f ms, p95 %.1f ms, max %.1f ms", latency.mean(), latency.percentile(95),
+           latency.percentile(100));
+  printf("\n");
+  printf("CPU: bus %.0f ns per frame over %u loop() call(s)", frames ? (double) bus_ns / frames : 0.0, loop.calls);
+  uint64_t device_ns = 0;
+  for (auto &device : devices)
+    device_ns += host::App.cpu(&device->component, "loop").ns;
+  printf(", publishing %.0f ns per value\n", publishes ? (double) device_ns / publishes : 0.0);
+
+  if (!options.record.empty()) {
+    // Through the same log output a device would produce
+    std::string log;
+    host::set_log_sink([&log](const std::string &line) { log += line + "\n"; });
+    bus.dump_capture();
+    host::set_log_sink(nullptr);
+    std::ofstream file(options.record, std::ios::binary);
+    file << log;
+    printf("capture written to %s\n", options.record.c_str());
+  }
+
+  if (mismatches) {
+    printf("FAIL: %u published value(s) differ from what the controller sent\n", mismatches);
+    return 1;
+  }
+  if (!replaying && resyncs < controller.noise_bursts + controller.oversized_frames) {
+    printf("FAIL: %u garbage frame(s) on the line, only %u resync(s)\n",
+           controller.noise_bursts + controller.oversized_frames, resyncs);
+    return 1;
+  }
+  // Without polling, each refresh asks every command once, plus the retries of failed attempts
+  uint32_t commands = 0;
+  for (auto &device : devices)
+    commands += device->schedules.size();
+  const uint32_t max_requests = refreshes * commands * (1 + options.max_retries);
+  if (!replaying && options.poll_interval_ms == 0 && controller.requests > max_requests) {
+    printf("FAIL: %u request(s) for %u refresh(es) of %u command(s) without polling\n", controller.requests,
+           refreshes, commands);
+    return 1;
+  }
+  if (frames == 0) {
+    printf("FAIL: no transaction completed\n");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,609 @@
+// Runs the real HLW8012Component on a simulated clock, fed by a model of the chip under scripted loads.
+//
+// The chip turns the true voltage, current and power into CF and CF1 pulse trains using the same constants codegen
+// derives for each model. CF1 follows SEL as the component drives it and takes a while to settle after a switch.
+// Every published value is compared with the truth over the window it was measured in. The report shows, per model,
+// configuration and load profile, the error of each quantity, how long each took to come within tolerance after a
+// load change, and the CPU time spent per update and per interrupt.
+
+#include "host_runtime.h"
+#include "hlw8012/hlw8012.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cmath>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <memory>
+#include <random>
+#include <string>
+#include <vector>
+
+using namespace esphome;
+using namespace esphome::hlw8012;
+
+// Defaults of sensor.py
+static const double CURRENT_RESISTOR = 0.001;
+static const double VOLTAGE_DIVIDER = 2351;
+// Valid for HLW8012 and CSE7759
+static const double HLW8012_CLOCK_FREQUENCY = 3579000;
+// How often the chip model re-evaluates the load and SEL
+static const uint64_t CHIP_STEP_US = 10000;
+// Errors are relative to the truth, but at least to these, so a near-zero load is not judged by its relative error
+static const double VOLTAGE_FLOOR = 1.0, CURRENT_FLOOR = 0.05, POWER_FLOOR = 5.0;
+static const double MAX_ENERGY_ERROR = 0.01;
+
+struct Multipliers {
+  // W, A and V per Hz
+  double power, current, voltage;
+};
+
+static Multipliers hlw8012_multipliers() {
+  const double reference_voltage = 2.43;
+  return {reference_voltage * reference_voltage * VOLTAGE_DIVIDER / CURRENT_RESISTOR * 64 / 24 /
+              HLW8012_CLOCK_FREQUENCY,
+          reference_voltage / CURRENT_RESISTOR * 512 / 24 / HLW8012_CLOCK_FREQUENCY,
+          reference_voltage * VOLTAGE_DIVIDER * 256 / HLW8012_CLOCK_FREQUENCY};
+}
+
+static Multipliers bl0937_multipliers() {
+  const double reference_voltage = 1.218;
+  return {reference_voltage * reference_voltage * VOLTAGE_DIVIDER / CURRENT_RESISTOR / 4596355,
+          reference_voltage / CURRENT_RESISTOR / 222170, reference_voltage * VOLTAGE_DIVIDER / 39576};
+}
+
+struct Model {
+  const char *name;
+  Multipliers (*multipliers)();
+};
+
+static const Model MODELS[] = {
+    {"HLW8012", hlw8012_multipliers},
+    {"CSE7759", hlw8012_multipliers},
+    {"BL0937", bl0937_multipliers},
+};
+
+struct Configuration {
+  const char *name;
+  HLW8012MeasurementMode mode;
+  bool adaptive;
+};
+
+static const Configuration CONFIGURATIONS[] = {
+    {"pulse_count", HLW8012_MEASUREMENT_MODE_COUNT, false},
+    {"edge_period", HLW8012_MEASUREMENT_MODE_PERIOD, false},
+    {"edge_period adaptive", HLW8012_MEASUREMENT_MODE_PERIOD, true},
+};
+
+struct Load {
+  double voltage, current, power_factor;
+  double power() const { return voltage * current * power_factor; }
+};
+
+// A load over time. Some profiles react to SEL, which the chip reports to them through sel_switched().
+class Profile {
+ public:
+  virtual ~Profile() = default;
+  virtual const char *name() const = 0;
+  virtual Load at(double t) const = 0;
+  // Times in s at which the load jumps, for the time to accuracy
+  virtual std::vector<double> changes() const { return {}; }
+  virtual void sel_switched(double t, bool current) {}
+  // Without any load the power factor is undefined and need not be published
+  virtual bool loaded() const { return true; }
+};
+
+// Current steps from a small to a large load and partly back, voltage sags once
+class StepProfile : public Profile {
+ public:
+  explicit StepProfile(double duration) : duration_(duration) {}
+  const char *name() const override { return "step"; }
+  Load at(double t) const override {
+    const double current = t < duration_ / 3 ? 0.5 : t < 2 * duration_ / 3 ? 8.0 : 2.0;
+    return {t < duration_ / 2 ? 230.0 : 225.0, current, 0.9};
+  }
+  std::vector<double> changes() const override { return {duration_ / 3, duration_ / 2, 2 * duration_ / 3}; }
+
+ protected:
+  double duration_;
+};
+
+// Current ramps from zero to 10 A while the voltage drifts slowly
+class RampProfile : public Profile {
+ public:
+  explicit RampProfile(double duration) : duration_(duration) {}
+  const char *name() const override { return "ramp"; }
+  Load at(double t) const override {
+    return {230.0 + 5.0 * std::sin(2 * M_PI * t / 300), 10.0 * t / duration_, 0.95};
+  }
+
+ protected:
+  double duration_;
+};
+
+// Standby loads of a few watts, a handful of CF pulses per second or less
+class StandbyProfile : public Profile {
+ public:
+  explicit StandbyProfile(double duration) : duration_(duration) {}
+  const char *name() const override { return "standby"; }
+  Load at(double t) const override {
+    const double power = t < duration_ / 3 ? 5.0 : t < 2 * duration_ / 3 ? 8.0 : 15.0;
+    return {230.0, power / 230.0, 1.0};
+  }
+  std::vector<double> changes() const override { return {duration_ / 3, 2 * duration_ / 3}; }
+
+ protected:
+  double duration_;
+};
+
+// A few watts of standby load, then nothing at all
+class NearZeroProfile : public Profile {
+ public:
+  explicit NearZeroProfile(double duration) : duration_(duration) {}
+  const char *name() const override { return "near_zero"; }
+  Load at(double t) const override { return {230.0, t < duration_ / 2 ? 0.02 : 0.0, 0.6}; }
+  std::vector<double> changes() const override { return {duration_ / 2}; }
+
+ protected:
+  double duration_;
+};
+
+// Nothing connected, CF never pulses
+class OffProfile : public Profile {
+ public:
+  const char *name() const override { return "off"; }
+  Load at(double t) const override { return {230.0, 0.0, 1.0}; }
+  bool loaded() const override { return false; }
+};
+
+// The load changes shortly after every switch of SEL to voltage, so CF1 never sees the current change while it
+// happens and apparent power has to be interpolated across it
+class SelTransientProfile : public Profile {
+ public:
+  const char *name() const override { return "sel_transient"; }
+  Load at(double t) const override {
+    const size_t toggles = std::upper_bound(toggles_.begin(), toggles_.end(), t) - toggles_.begin();
+    return {230.0, toggles % 2 ? 6.0 : 2.0, 0.9};
+  }
+  std::vector<double> changes() const override { return toggles_; }
+  void sel_switched(double t, bool current) override {
+    if (!current)
+      toggles_.push_back(t + 0.5);
+  }
+
+ protected:
+  std::vector<double> toggles_;
+};
+
+// One pulse output of the chip, a rising edge every 1 / frequency
+struct PulseOutput {
+  InternalGPIOPin *pin;
+  double frequency{0};
+  // Fraction of the current period elapsed at last_us
+  double phase{0};
+  uint64_t last_us{0};
+
+  void advance(uint64_t now) {
+    phase += frequency * (now - last_us) / 1e6;
+    last_us = now;
+  }
+  uint64_t next_edge_us() const {
+    if (frequency <= 0)
+      return UINT64_MAX;
+    return last_us + (uint64_t) std::ceil(std::max(0.0, 1.0 - phase) / frequency * 1e6);
+  }
+};
+
+// SEL as the component drives it, pin inversion included
+class SelPin : public GPIOPin {
+ public:
+  using GPIOPin::GPIOPin;
+  void digital_write(bool value) override {
+    GPIOPin::digital_write(value);
+    if (on_write)
+      on_write();
+  }
+
+  std::function<void()> on_write;
+};
+
+// The chip: turns the load into CF and CF1 edges
+class Chip : public host::EventSource {
+ public:
+  Chip(const Multipliers &multipliers, Profile &profile, SelPin &sel, InternalGPIOPin &cf, InternalGPIOPin &cf1,
+       double sel_settle_s, uint32_t seed)
+      : multipliers_(multipliers), profile_(profile), sel_(sel), sel_settle_s_(sel_settle_s), rng_(seed) {
+    cf_.pin = &cf;
+    cf1_.pin = &cf1;
+    // CF1 follows SEL straight away rather than at the next step
+    sel_.on_write = [this]() {
+      const uint64_t now = host::now_us();
+      cf_.advance(now);
+      cf1_.advance(now);
+      this->step_(now);
+    };
+  }
+
+  uint64_t next_event_us() override {
+    return std::min({next_step_us_, cf_.next_edge_us(), cf1_.next_edge_us()});
+  }
+
+  void fire() override {
+    const uint64_t now = host::now_us();
+    for (PulseOutput *output : {&cf_, &cf1_}) {
+      output->advance(now);
+      if (output->phase >= 1.0 - 1e-9) {
+        output->phase = std::max(0.0, output->phase - 1.0);
+        const auto start = std::chrono::steady_clock::now();
+        output->pin->edge(true);
+        isr_ns_ += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start)
+                       .count();
+        edges_++;
+      }
+    }
+    if (now >= next_step_us_) {
+      this->step_(now);
+      next_step_us_ = now + CHIP_STEP_US;
+    }
+  }
+
+  double isr_ns_per_edge() const { return edges_ ? (double) isr_ns_ / edges_ : 0.0; }
+
+ protected:
+  void step_(uint64_t now) {
+    const double t = now / 1e6;
+    const bool current = sel_.digital_read();
+    if (current != sel_current_) {
+      sel_current_ = current;
+      sel_switched_ = t;
+      profile_.sel_switched(t, current);
+    }
+    const Load load = profile_.at(t);
+    // Converter noise of a fraction of a percent
+    std::normal_distribution<double> noise(1.0, 0.001);
+    cf_.frequency = load.power() / multipliers_.power * noise(rng_);
+    const double voltage_frequency = load.voltage / multipliers_.voltage * noise(rng_);
+    const double current_frequency = load.current / multipliers_.current * noise(rng_);
+    double cf1_frequency = current ? current_frequency : voltage_frequency;
+    // CF1 slides over from the other quantity for a while after SEL switched
+    const double settling = sel_settle_s_ > 0 ? (t - sel_switched_) / sel_settle_s_ : 1.0;
+    if (settling < 1.0)
+      cf1_frequency += (1.0 - settling) * ((current ? voltage_frequency : current_frequency) - cf1_frequency);
+    cf1_.frequency = cf1_frequency;
+  }
+
+  Multipliers multipliers_;
+  Profile &profile_;
+  SelPin &sel_;
+  double sel_settle_s_;
+  std::mt19937 rng_;
+  PulseOutput cf_;
+  PulseOutput cf1_;
+  uint64_t next_step_us_{0};
+  bool sel_current_{false};
+  double sel_switched_{-1e9};
+  uint64_t isr_ns_{0};
+  uint64_t edges_{0};
+};
+
+// Published values of one quantity and the truth over the window each was measured in
+struct Quantity {
+  const char *name;
+  double floor;
+  bool trace;
+  std::vector<double> times, errors;
+
+  void add(double t, double value, double truth) {
+    if (trace)
+      printf("%10.3f %-2s %12.4f truth %12.4f\n", t, name, value, truth);
+    times.push_back(t);
+    errors.push_back(std::fabs(value - truth) / std::max(std::fabs(truth), floor));
+  }
+  double mean() const {
+    double sum = 0;
+    for (double error : errors)
+      sum += error;
+    return errors.empty() ? NAN : sum / errors.size();
+  }
+  double percentile(double percent) const {
+    if (errors.empty())
+      return NAN;
+    std::vector<double> sorted = errors;
+    std::sort(sorted.begin(), sorted.end());
+    return sorted[std::min(sorted.size() - 1, (size_t) (percent / 100 * sorted.size()))];
+  }
+  // Longest time after a change until every later value before the next change was within tolerance, -1 if one
+  // never got there
+  double time_to_accuracy(std::vector<double> changes, double end, double tolerance) const {
+    double worst = 0;
+    changes.push_back(end);
+    for (size_t c = 0; c + 1 < changes.size(); c++) {
+      double settled = -1;
+      for (size_t i = 0; i < times.size(); i++) {
+        if (times[i] <= changes[c] || times[i] > changes[c + 1])
+          continue;
+        if (errors[i] > tolerance) {
+          settled = -1;
+        } else if (settled < 0) {
+          settled = times[i];
+        }
+      }
+      if (settled < 0)
+        return -1;
+      worst = std::max(worst, settled - changes[c]);
+    }
+    return worst;
+  }
+};
+
+struct Options {
+  uint32_t seconds = 600;
+  uint32_t update_interval_ms = 1000;
+  uint32_t change_mode_every = 8;
+  // CF is sampled this often for the power window, 0 reads it once per update
+  uint32_t sample_interval_ms = 0;
+  double tolerance = 0.01;
+  // CF1 glides from the old quantity to the new one for this long after SEL switched
+  uint32_t sel_settle_ms = 200;
+  // Adds an on_overload trigger at this power in W to edge_period runs, 0 for none
+  double overload_w = 0;
+  uint32_t seed = 1;
+  std::string model, configuration, profile;
+  bool verbose = false;
+  // Prints every published value with its truth
+  bool trace = false;
+  // Also fails runs in which a quantity never came within tolerance after a load change
+  bool strict = false;
+};
+
+// Mean of the truth over the window ending at t
+static Load window_truth(const Profile &profile, double t, double window) {
+  const int steps = 100;
+  Load sum{0, 0, 0};
+  double power = 0;
+  for (int i = 0; i < steps; i++) {
+    const Load load = profile.at(std::max(0.0, t - window + (i + 0.5) * window / steps));
+    sum.voltage += load.voltage / steps;
+    sum.current += load.current / steps;
+    power += load.power() / steps;
+  }
+  sum.power_factor = sum.voltage * sum.current != 0 ? power / (sum.voltage * sum.current) : 0;
+  return sum;
+}
+
+static bool run(const Model &model, const Configuration &configuration, Profile &profile, const Options &options) {
+  host::App.reset();
+  const Multipliers multipliers = model.multipliers();
+  SelPin sel(12);
+  InternalGPIOPin cf(4), cf1(5);
+  sensor::Sensor voltage_sensor("voltage"), current_sensor("current"), power_sensor("power"),
+      apparent_power_sensor("apparent power"), power_factor_sensor("power factor"), energy_sensor("energy");
+
+  HLW8012Component component(false, false);
+  component.set_update_interval(options.update_interval_ms);
+  component.set_initial_mode(HLW8012_INITIAL_MODE_VOLTAGE);
+  component.set_measurement_mode(configuration.mode);
+  component.set_adaptive_mode_switching(configuration.adaptive);
+  component.set_change_mode_every(configuration.adaptive ? 0 : options.change_mode_every);
+  component.set_multipliers(std::llround(multipliers.power * 1e9), std::llround(multipliers.current * 1e9),
+                            std::llround(multipliers.voltage * 1e9));
+  component.set_sel_pin(&sel);
+  component.set_cf_pin(&cf);
+  component.set_cf1_pin(&cf1);
+  component.set_voltage_sensor(&voltage_sensor);
+  component.set_current_sensor(&current_sensor);
+  component.set_power_sensor(&power_sensor);
+  component.set_apparent_power_sensor(&apparent_power_sensor);
+  component.set_power_factor_sensor(&power_factor_sensor);
+  component.set_energy_sensor(&energy_sensor);
+  // Storage for the power window over one update, as codegen sizes it for sample_window
+  const uint32_t window_samples =
+      options.sample_interval_ms ? std::max<uint32_t>(1, options.update_interval_ms / options.sample_interval_ms) : 0;
+  std::vector<uint32_t> window_storage(3 * window_samples);
+  if (options.sample_interval_ms) {
+    component.set_sample_interval(options.sample_interval_ms);
+    component.get_power_window().set_storage(window_storage.data(), window_storage.data() + window_samples,
+                                             window_storage.data() + 2 * window_samples, window_samples);
+  }
+
+  // As codegen computes the threshold period, held for 100 ms. It must only fire while the load is above it.
+  const bool overload = options.overload_w > 0 && configuration.mode == HLW8012_MEASUREMENT_MODE_PERIOD;
+  OverloadTrigger overload_trigger(std::lround(multipliers.power * 1e6 / options.overload_w), 100);
+  uint32_t overloads = 0, false_overloads = 0;
+  if (overload) {
+    component.add_overload_trigger(&overload_trigger);
+    overload_trigger.add_host_callback([&](float value) {
+      const double t = host::now_us() / 1e6;
+      overloads++;
+      bool above = false;
+      for (int i = 0; i <= 100; i++)
+        above |= profile.at(std::max(0.0, t - i * 0.01)).power() >= options.overload_w;
+      if (!above) {
+        false_overloads++;
+        if (options.trace)
+          printf("%10.3f overload at %.1f W, the load is %.1f W\n", t, value, profile.at(t).power());
+      }
+    });
+  }
+
+  Chip chip(multipliers, profile, sel, cf, cf1, options.sel_settle_ms / 1000.0, options.seed);
+  host::App.add(&component);
+  host::App.add_event_source(&chip);
+
+  const double window = options.update_interval_ms / 1000.0;
+  Quantity voltage{"V", VOLTAGE_FLOOR, options.trace}, current{"I", CURRENT_FLOOR, options.trace},
+      power{"P", POWER_FLOOR, options.trace}, apparent_power{"S", POWER_FLOOR, options.trace},
+      power_factor{"PF", 1.0, options.trace};
+  double voltage_time = -1, current_time = -1;
+  voltage_sensor.add_on_state_callback([&](float value) {
+    const double t = host::now_us() / 1e6;
+    voltage.add(t, value, window_truth(profile, t, window).voltage);
+    voltage_time = t;
+  });
+  current_sensor.add_on_state_callback([&](float value) {
+    const double t = host::now_us() / 1e6;
+    current.add(t, value, window_truth(profile, t, window).current);
+    current_time = t;
+  });
+  power_sensor.add_on_state_callback([&](float value) {
+    const double t = host::now_us() / 1e6;
+    const Load truth = window_truth(profile, t, window);
+    power.add(t, value, truth.power_factor * truth.voltage * truth.current);
+  });
+  // Apparent power and power factor describe the older of the latest voltage and current readings
+  apparent_power_sensor.add_on_state_callback([&](float value) {
+    const Load truth = window_truth(profile, std::min(voltage_time, current_time), window);
+    apparent_power.add(host::now_us() / 1e6, value, truth.voltage * truth.current);
+  });
+  power_factor_sensor.add_on_state_callback([&](float value) {
+    const Load truth = window_truth(profile, std::min(voltage_time, current_time), window);
+    power_factor.add(host::now_us() / 1e6, value, truth.power_factor);
+  });
+
+  host::App.setup();
+  if (options.verbose)
+    host::App.dump_config();
+  const double end = options.seconds;
+  host::App.run_until((uint64_t) options.seconds * 1000000);
+
+  // Energy against the integral of the true power
+  double true_energy = 0;
+  for (double t = 0.0005; t < end; t += 0.001)
+    true_energy += profile.at(t).power() * 0.001 / 3600;
+  const double energy_error =
+      std::fabs(energy_sensor.get_state() - true_energy) / std::max(true_energy, POWER_FLOOR * end / 3600);
+
+  const host::CpuStats update = host::App.cpu(&component, "update");
+  printf("%-8s %-21s %-13s", model.name, configuration.name, profile.name());
+  // Every quantity is published and energy, which counts every pulse, is right whatever the load
+  bool passed = energy_error <= MAX_ENERGY_ERROR;
+  for (const Quantity *quantity : {&voltage, &current, &power, &apparent_power, &power_factor}) {
+    printf(" %5.2f/%6.2f", quantity->mean() * 100, quantity->percentile(95) * 100);
+    passed &= !quantity->errors.empty() || (quantity == &power_factor && !profile.loaded());
+  }
+  printf(" %6.2f", energy_error * 100);
+  for (const Quantity *quantity : {&voltage, &current, &power}) {
+    const double tta = quantity->time_to_accuracy(profile.changes(), end, options.tolerance);
+    if (tta < 0) {
+      printf("  never");
+    } else {
+      printf(" %6.1f", tta);
+    }
+    if (options.strict)
+      passed &= tta >= 0;
+  }
+  printf(" %9.0f %7.0f\n", update.mean_ns(), chip.isr_ns_per_edge());
+  if (overload) {
+    printf("%-8s overload above %.0f W fired %u time(s), %u below it\n", "", options.overload_w, overloads,
+           false_overloads);
+    passed &= false_overloads == 0;
+  }
+  return passed;
+}
+
+static bool parse_options(int argc, char **argv, Options *options) {
+  for (int i = 1; i < argc; i++) {
+    const std::string arg = argv[i];
+    if (arg == "--verbose") {
+      options->verbose = true;
+      continue;
+    }
+    if (arg == "--trace") {
+      options->trace = true;
+      continue;
+    }
+    if (arg == "--strict") {
+      options->strict = true;
+      continue;
+    }
+    if (i + 1 >= argc)
+      return false;
+    const char *value = argv[++i];
+    if (arg == "--seconds") {
+      options->seconds = atoi(value);
+    } else if (arg == "--update-interval-ms") {
+      options->update_interval_ms = atoi(value);
+    } else if (arg == "--sample-interval-ms") {
+      options->sample_interval_ms = atoi(value);
+    } else if (arg == "--change-mode-every") {
+      options->change_mode_every = atoi(value);
+    } else if (arg == "--sel-settle-ms") {
+      options->sel_settle_ms = atoi(value);
+    } else if (arg == "--overload-w") {
+      options->overload_w = atof(value);
+    } else if (arg == "--tolerance") {
+      options->tolerance = atof(value);
+    } else if (arg == "--seed") {
+      options->seed = atoi(value);
+    } else if (arg == "--model") {
+      options->model = value;
+    } else if (arg == "--configuration") {
+      options->configuration = value;
+    } else if (arg == "--profile") {
+      options->profile = value;
+    } else {
+      return false;
+    }
+  }
+  return options->seconds > 0 && options->update_interval_ms > 0;
+}
+
+int main(int argc, char **argv) {
+  Options options;
+  if (!parse_options(argc, argv, &options)) {
+    fprintf(stderr,
+            "usage: %s [--seconds N] [--update-interval-ms N] [--sample-interval-ms N]\n"
+            "          [--change-mode-every N] [--sel-settle-ms N] [--overload-w W] [--tolerance F] [--seed N]\n"
+            "          [--model NAME] [--configuration NAME] [--profile NAME] [--strict] [--verbose] [--trace]\n",
+            argv[0]);
+    return 2;
+  }
+  host::log_level = options.verbose ? ESPHOME_LOG_LEVEL_DEBUG : ESPHOME_LOG_LEVEL_ERROR;
+
+  printf("%u s per run, update every %u ms, SEL every %u updates unless adaptive, tolerance %.1f%%\n",
+         options.seconds, options.update_interval_ms, options.change_mode_every, options.tolerance * 100);
+  printf("Errors in %% of the truth over the measurement window, mean/p95. Energy error at the end of the run,\n"
+         "time to accuracy in s after the worst load change, CPU in ns per update and per interrupt.\n");
+  printf("%-8s %-21s %-13s %12s %12s %12s %12s %12s %6s %6s %6s %6s %9s %7s\n", "model", "configuration", "profile",
+         "V", "I", "P", "S", "PF", "E", "tta V", "tta I", "tta P", "update", "isr");
+
+  const double duration = options.seconds;
+  std::vector<std::function<std::unique_ptr<Profile>()>> profiles = {
+      [duration]() { return std::unique_ptr<Profile>(new StepProfile(duration)); },
+      [duration]() { return std::unique_ptr<Profile>(new RampProfile(duration)); },
+      [duration]() { return std::unique_ptr<Profile>(new StandbyProfile(duration)); },
+      [duration]() { return std::unique_ptr<Profile>(new NearZeroProfile(duration)); },
+      []() { return std::unique_ptr<Profile>(new SelTransientProfile()); },
+      []() { return std::unique_ptr<Profile>(new OffProfile()); },
+  };
+
+  int runs = 0, failures = 0;
+  for (const Model &model : MODELS) {
+    if (!options.model.empty() && options.model != model.name)
+      continue;
+    for (const Configuration &configuration : CONFIGURATIONS) {
+      if (!options.configuration.empty() && options.configuration != configuration.name)
+        continue;
+      for (const auto &make_profile : profiles) {
+        std::unique_ptr<Profile> profile = make_profile();
+        if (!options.profile.empty() && options.profile != profile->name())
+          continue;
+        runs++;
+        if (!run(model, configuration, *profile, options))
+          failures++;
+      }
+    }
+  }
+  if (runs == 0) {
+    fprintf(stderr, "nothing matches the given model, configuration and profile\n");
+    return 2;
+  }
+  if (failures) {
+    printf("FAIL: %d of %d run(s) missed a quantity, the energy total%s%s\n", failures, runs,
+           options.strict ? ", the tolerance" : "", options.overload_w > 0 ? " or fired a false overload" : "");
+    return 1;
+  }
+  return 0;
+}
@@ -0,0 +1,294 @@
+#include "host_runtime.h"
+
+#include "esphome/core/component.h"
+#include "esphome/core/hal.h"
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+#include "esphome/core/preferences.h"
+#include "esphome/components/api/api_server.h"
+#include "esphome/components/pulse_counter/pulse_counter_sensor.h"
+
+#include <algorithm>
+#include <chrono>
+#include <cstdarg>
+#include <functional>
+#include <map>
+#include <memory>
+#include <utility>
+
+namespace esphome {
+
+namespace setup_priority {
+const float BUS = 1000.0f;
+const float IO = 900.0f;
+const float HARDWARE = 800.0f;
+const float DATA = 600.0f;
+const float PROCESSOR = 400.0f;
+const float AFTER_WIFI = 200.0f;
+}  // namespace setup_priority
+
+namespace host {
+
+Application App;
+int log_level = ESPHOME_LOG_LEVEL_WARN;
+
+static uint64_t clock_us = 0;
+
+uint64_t now_us() { return clock_us; }
+void set_now_us(uint64_t now) { clock_us = now; }
+
+static std::function<void(const std::string &)> log_sink;
+
+void set_log_sink(std::function<void(const std::string &)> &&sink) { log_sink = std::move(sink); }
+
+void log(int level, const char *tag, const char *format, ...) {
+  if (level > log_level && !log_sink)
+    return;
+  static const char LEVELS[] = "?EWICDV";
+  char line[512];
+  int len = snprintf(line, sizeof(line), "[%10.3f][%c][%s] ", clock_us / 1e6, LEVELS[level], tag);
+  va_list args;
+  va_start(args, format);
+  vsnprintf(line + len, sizeof(line) - len, format, args);
+  va_end(args);
+  if (level <= log_level)
+    printf("%s\n", line);
+  if (log_sink)
+    log_sink(line);
+}
+
+namespace {
+
+struct Timer {
+  Component *component;
+  std::string name;
+  bool interval;
+  uint32_t period;
+  uint64_t due;
+  // Keeps timers added at the same time in order
+  uint64_t sequence;
+  std::shared_ptr<std::function<void()>> callback;
+  bool removed;
+};
+
+std::vector<Timer> timers;
+uint64_t timer_sequence = 0;
+std::map<std::pair<const Component *, std::string>, CpuStats> cpu_stats;
+
+bool cancel(Component *component, const std::string &name, bool interval) {
+  bool found = false;
+  for (auto &timer : timers) {
+    if (!timer.removed && timer.component == component && timer.interval == interval && timer.name == name) {
+      timer.removed = true;
+      found = true;
+    }
+  }
+  return found;
+}
+
+void add(Component *component, const std::string &name, bool interval, uint32_t period, std::function<void()> &&f) {
+  cancel(component, name, interval);
+  if (period == SCHEDULER_DONT_RUN)
+    return;
+  timers.push_back({component, name, interval, period, clock_us + period * 1000ULL, timer_sequence++,
+                    std::make_shared<std::function<void()>>(std::move(f)), false});
+}
+
+template<typename F> void timed(const Component *component, const std::string &name, F &&f) {
+  const auto start = std::chrono::steady_clock::now();
+  f();
+  const auto elapsed = std::chrono::steady_clock::now() - start;
+  CpuStats &stats = cpu_stats[{component, name}];
+  stats.ns += std::chrono::duration_cast<std::chrono::nanoseconds>(elapsed).count();
+  stats.calls++;
+}
+
+// Runs the earliest due timer, returns false if none is due
+bool run_due_timer() {
+  timers.erase(std::remove_if(timers.begin(), timers.end(), [](const Timer &timer) { return timer.removed; }),
+               timers.end());
+  auto next = timers.end();
+  for (auto it = timers.begin(); it != timers.end(); ++it) {
+    if (it->due <= clock_us && (next == timers.end() || it->due < next->due ||
+                                (it->due == next->due && it->sequence < next->sequence)))
+      next = it;
+  }
+  if (next == timers.end())
+    return false;
+  Component *component = next->component;
+  const std::string name = next->name;
+  // The callback may add or cancel timers, which can move the vector
+  auto callback = next->callback;
+  if (next->interval) {
+    next->due += next->period * 1000ULL;
+    next->sequence = timer_sequence++;
+  } else {
+    next->removed = true;
+  }
+  timed(component, name, [&callback]() { (*callback)(); });
+  return true;
+}
+
+uint64_t next_timer_us() {
+  uint64_t next = UINT64_MAX;
+  for (const auto &timer : timers) {
+    if (!timer.removed)
+      next = std::min(next, timer.due);
+  }
+  return next;
+}
+
+}  // namespace
+
+void Application::setup() {
+  for (auto *component : components_) {
+    component->setup();
+    if (auto *polling = dynamic_cast<PollingComponent *>(component))
+      polling->start_poller();
+  }
+}
+
+void Application::dump_config() {
+  for (auto *component : components_)
+    component->dump_config();
+}
+
+void Application::run_loops_() {
+  for (auto *component : components_) {
+    if (component->is_loop_enabled())
+      timed(component, "loop", [component]() { component->loop(); });
+  }
+}
+
+void Application::run_until(uint64_t until_us) {
+  while (clock_us < until_us) {
+    for (auto *source : sources_) {
+      while (source->next_event_us() <= clock_us)
+        source->fire();
+    }
+    while (run_due_timer()) {
+    }
+    this->run_loops_();
+
+    uint64_t next = std::min(until_us, next_timer_us());
+    for (auto *source : sources_)
+      next = std::min(next, source->next_event_us());
+    const bool looping = std::any_of(components_.begin(), components_.end(),
+                                     [](const Component *component) { return component->is_loop_enabled(); });
+    if (looping)
+      next = std::min(next, clock_us + loop_tick_us_);
+    clock_us = std::max(next, clock_us + 1);
+  }
+}
+
+void Application::reset() {
+  components_.clear();
+  sources_.clear();
+  timers.clear();
+  cpu_stats.clear();
+  global_preferences->clear();
+  clock_us = 0;
+}
+
+CpuStats Application::cpu(const Component *component, const std::string &name) const {
+  auto it = cpu_stats.find({component, name});
+  return it == cpu_stats.end() ? CpuStats{} : it->second;
+}
+
+}  // namespace host
+
+uint32_t millis() { return host::clock_us / 1000; }
+uint32_t micros() { return host::clock_us; }
+
+void Component::set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f) {
+  host::add(this, name, true, interval, std::move(f));
+}
+void Component::set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f) {
+  host::add(this, name, false, timeout, std::move(f));
+}
+bool Component::cancel_interval(const std::string &name) { return host::cancel(this, name, true); }
+bool Component::cancel_timeout(const std::string &name) { return host::cancel(this, name, false); }
+
+void PollingComponent::start_poller() {
+  this->set_interval("update", this->update_interval_, [this]() { this->update(); });
+}
+void PollingComponent::stop_poller() { this->cancel_interval("update"); }
+
+uint32_t fnv1_hash(const std::string &str) {
+  uint32_t hash = 2166136261UL;
+  for (char c : str) {
+    hash *= 16777619UL;
+    hash ^= c;
+  }
+  return hash;
+}
+
+static const char BASE64_CHARS[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+std::string base64_encode(const uint8_t *buf, size_t buf_len) {
+  std::string encoded;
+  for (size_t i = 0; i < buf_len; i += 3) {
+    uint32_t group = buf[i] << 16;
+    if (i + 1 < buf_len)
+      group |= buf[i + 1] << 8;
+    if (i + 2 < buf_len)
+      group |= buf[i + 2];
+    // n remaining bytes give n + 1 characters, padded to 4
+    for (size_t j = 0; j < 4; j++)
+      encoded += j <= buf_len - i ? BASE64_CHARS[(group >> (18 - 6 * j)) & 0x3F] : '=';
+  }
+  return encoded;
+}
+
+std::vector<uint8_t> base64_decode(const std::string &encoded) {
+  std::vector<uint8_t> decoded;
+  uint32_t group = 0;
+  int bits = 0;
+  for (char c : encoded) {
+    const char *pos = std::find(BASE64_CHARS, BASE64_CHARS + 64, c);
+    if (pos == BASE64_CHARS + 64)
+      continue;
+    group = (group << 6) | (pos - BASE64_CHARS);
+    bits += 6;
+    if (bits >= 8) {
+      bits -= 8;
+      decoded.push_back(group >> bits);
+    }
+  }
+  return decoded;
+}
+
+static ESPPreferences preferences;
+ESPPreferences *global_preferences = &preferences;
+
+namespace api {
+static APIServer api_server;
+APIServer *global_api_server = &api_server;
+}  // namespace api
+
+namespace pulse_counter {
+
+// Counts in the interrupt like the software counter of the pulse_counter component
+struct HostPulseCounterStorage : public PulseCounterStorageBase {
+  static void gpio_intr(HostPulseCounterStorage *arg) { arg->counter = arg->counter + 1; }
+  bool pulse_counter_setup(InternalGPIOPin *pin) override {
+    pin->setup();
+    pin->attach_interrupt(HostPulseCounterStorage::gpio_intr, this, gpio::INTERRUPT_RISING_EDGE);
+    return true;
+  }
+  pulse_counter_t read_raw_value() override {
+    const pulse_counter_t counter = this->counter;
+    const pulse_counter_t ret = counter - this->last_value;
+    this->last_value = counter;
+    return ret;
+  }
+
+  volatile pulse_counter_t counter{0};
+  pulse_counter_t last_value{0};
+};
+
+PulseCounterStorageBase *get_storage(bool hw_pcnt) { return new HostPulseCounterStorage(); }
+
+}  // namespace pulse_counter
+
+}  // namespace esphome
@@ -0,0 +1,63 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#include "esphome/core/component.h"
+
+// A single-threaded stand-in for the ESPHome application loop. Time only moves when run_until() advances it:
+// straight to the next timer or event while no component wants loop(), in fixed ticks while one does.
+
+namespace esphome {
+namespace host {
+
+uint64_t now_us();
+void set_now_us(uint64_t now);
+
+// Something outside the components that happens at a known time, e.g. a pulse on a pin
+class EventSource {
+ public:
+  virtual ~EventSource() = default;
+  // Time of the next event in us, UINT64_MAX if there is none
+  virtual uint64_t next_event_us() = 0;
+  // Called once the clock has reached next_event_us()
+  virtual void fire() = 0;
+};
+
+// Wall-clock time spent in the components, for the CPU cost reports
+struct CpuStats {
+  uint64_t ns{0};
+  uint32_t calls{0};
+  double mean_ns() const { return calls ? (double) ns / calls : 0.0; }
+};
+
+class Application {
+ public:
+  void add(Component *component) { components_.push_back(component); }
+  void add_event_source(EventSource *source) { sources_.push_back(source); }
+  // Time between loop() passes while any component has its loop enabled
+  void set_loop_tick_us(uint32_t tick) { loop_tick_us_ = tick; }
+
+  // setup() in the order added, then the pollers
+  void setup();
+  void dump_config();
+  void run_until(uint64_t until_us);
+  // Forgets all components, timers, CPU stats and preferences and sets the clock back to 0, for the next run
+  void reset();
+
+  // Time spent in a component: "loop", or the name of a timer such as "update"
+  CpuStats cpu(const Component *component, const std::string &name) const;
+
+ protected:
+  void run_loops_();
+
+  std::vector<Component *> components_;
+  std::vector<EventSource *> sources_;
+  uint32_t loop_tick_us_{1000};
+};
+
+extern Application App;
+
+}  // namespace host
+}  // namespace esphome
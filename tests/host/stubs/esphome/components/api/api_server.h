@@ -0,0 +1,19 @@
+#pragma once
+
+namespace esphome {
+namespace api {
+
+class APIServer {
+ public:
+  bool is_connected() const { return connected_; }
+  // Host only: whether a client is connected
+  void set_connected(bool connected) { connected_ = connected; }
+
+ protected:
+  bool connected_{true};
+};
+
+extern APIServer *global_api_server;
+
+}  // namespace api
+}  // namespace esphome
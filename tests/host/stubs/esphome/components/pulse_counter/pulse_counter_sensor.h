@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdint>
+
+#include "esphome/core/hal.h"
+
+namespace esphome {
+namespace pulse_counter {
+
+using pulse_counter_t = int32_t;
+
+struct PulseCounterStorageBase {
+  virtual ~PulseCounterStorageBase() = default;
+  virtual bool pulse_counter_setup(InternalGPIOPin *pin) = 0;
+  // Edges counted since the last call
+  virtual pulse_counter_t read_raw_value() = 0;
+
+  uint32_t filter_us = 0;
+};
+
+// There is no hardware counter on the host, both return a counter of rising edges in the pin interrupt
+PulseCounterStorageBase *get_storage(bool hw_pcnt = false);
+
+}  // namespace pulse_counter
+}  // namespace esphome
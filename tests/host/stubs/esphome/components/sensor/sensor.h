@@ -0,0 +1,43 @@
+#pragma once
+
+#include <cmath>
+#include <functional>
+#include <string>
+#include <utility>
+
+#include "esphome/core/helpers.h"
+#include "esphome/core/log.h"
+
+namespace esphome {
+namespace sensor {
+
+class Sensor {
+ public:
+  Sensor() = default;
+  explicit Sensor(std::string name) : name_(std::move(name)) {}
+
+  void publish_state(float state) {
+    this->state = state;
+    has_state_ = true;
+    callback_.call(state);
+  }
+  void add_on_state_callback(std::function<void(float)> &&callback) { callback_.add(std::move(callback)); }
+  bool has_state() const { return has_state_; }
+  float get_state() const { return state; }
+  const std::string &get_name() const { return name_; }
+  uint32_t get_object_id_hash() const { return fnv1_hash(name_); }
+
+  float state{NAN};
+
+ protected:
+  std::string name_;
+  bool has_state_{false};
+  CallbackManager<void(float)> callback_;
+};
+
+}  // namespace sensor
+}  // namespace esphome
+
+#define LOG_SENSOR(prefix, type, obj) \
+  if ((obj) != nullptr) \
+    ESP_LOGCONFIG(TAG, "%s%s '%s'", prefix, type, (obj)->get_name().c_str());
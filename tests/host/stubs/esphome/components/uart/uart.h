@@ -0,0 +1,45 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+
+namespace esphome {
+namespace uart {
+
+enum UARTParityOptions { UART_CONFIG_PARITY_NONE, UART_CONFIG_PARITY_EVEN, UART_CONFIG_PARITY_ODD };
+
+// Implemented by the simulated bus of the harness
+class UARTComponent {
+ public:
+  virtual ~UARTComponent() = default;
+  virtual void write_array(const uint8_t *data, size_t len) = 0;
+  virtual bool read_array(uint8_t *data, size_t len) = 0;
+  virtual int available() = 0;
+  virtual void flush() {}
+};
+
+class UARTDevice {
+ public:
+  UARTDevice() = default;
+  explicit UARTDevice(UARTComponent *parent) : parent_(parent) {}
+  void set_uart_parent(UARTComponent *parent) { parent_ = parent; }
+
+  void write_array(const uint8_t *data, size_t len) { parent_->write_array(data, len); }
+  bool read_array(uint8_t *data, size_t len) { return parent_->read_array(data, len); }
+  bool read_byte(uint8_t *data) { return parent_->read_array(data, 1); }
+  uint8_t read() {
+    uint8_t data = 0;
+    read_byte(&data);
+    return data;
+  }
+  int available() { return parent_->available(); }
+  void flush() { parent_->flush(); }
+  void check_uart_settings(uint32_t baud_rate, uint8_t stop_bits = 1,
+                           UARTParityOptions parity = UART_CONFIG_PARITY_NONE, uint8_t data_bits = 8) {}
+
+ protected:
+  UARTComponent *parent_{nullptr};
+};
+
+}  // namespace uart
+}  // namespace esphome
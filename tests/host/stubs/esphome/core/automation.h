@@ -0,0 +1,31 @@
+#pragma once
+
+#include <functional>
+#include <utility>
+#include <vector>
+
+#include "esphome/core/component.h"
+#include "esphome/core/helpers.h"
+
+namespace esphome {
+
+// Instead of running an automation, a trigger calls whatever the harness attached to it
+template<typename... Ts> class Trigger {
+ public:
+  void trigger(Ts... x) {
+    for (auto &callback : callbacks_)
+      callback(x...);
+  }
+  void add_host_callback(std::function<void(Ts...)> &&callback) { callbacks_.push_back(std::move(callback)); }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+
+template<typename... Ts> class Action {
+ public:
+  virtual ~Action() = default;
+  virtual void play(Ts... x) = 0;
+};
+
+}  // namespace esphome
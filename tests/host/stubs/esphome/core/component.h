@@ -0,0 +1,61 @@
+#pragma once
+
+#include <cstdint>
+#include <functional>
+#include <string>
+
+namespace esphome {
+
+namespace setup_priority {
+extern const float BUS;
+extern const float IO;
+extern const float HARDWARE;
+extern const float DATA;
+extern const float PROCESSOR;
+extern const float AFTER_WIFI;
+}  // namespace setup_priority
+
+static const uint32_t SCHEDULER_DONT_RUN = 4294967295UL;
+
+// Timers are kept by host_runtime and run on the simulated clock
+class Component {
+ public:
+  virtual ~Component() = default;
+  virtual void setup() {}
+  virtual void loop() {}
+  virtual void dump_config() {}
+  virtual float get_setup_priority() const { return 0.0f; }
+  virtual void on_shutdown() {}
+
+  void disable_loop() { loop_enabled_ = false; }
+  void enable_loop() { loop_enabled_ = true; }
+  bool is_loop_enabled() const { return loop_enabled_; }
+  void mark_failed() { failed_ = true; }
+  bool is_failed() const { return failed_; }
+
+ protected:
+  void set_interval(const std::string &name, uint32_t interval, std::function<void()> &&f);
+  void set_timeout(const std::string &name, uint32_t timeout, std::function<void()> &&f);
+  bool cancel_interval(const std::string &name);
+  bool cancel_timeout(const std::string &name);
+
+  bool loop_enabled_{true};
+  bool failed_{false};
+};
+
+class PollingComponent : public Component {
+ public:
+  PollingComponent() = default;
+  explicit PollingComponent(uint32_t update_interval) : update_interval_(update_interval) {}
+  virtual void update() = 0;
+  virtual void set_update_interval(uint32_t update_interval) { update_interval_ = update_interval; }
+  virtual uint32_t get_update_interval() const { return update_interval_; }
+  // Called by host_runtime after setup(), like PollingComponent::call_setup()
+  void start_poller();
+  void stop_poller();
+
+ protected:
+  uint32_t update_interval_{0};
+};
+
+}  // namespace esphome
@@ -0,0 +1,62 @@
+#pragma once
+
+#include <cstdint>
+#include <string>
+#include <vector>
+
+#define IRAM_ATTR
+
+namespace esphome {
+
+// Driven by the simulated clock of host_runtime
+uint32_t millis();
+uint32_t micros();
+
+namespace gpio {
+enum InterruptType { INTERRUPT_RISING_EDGE, INTERRUPT_FALLING_EDGE, INTERRUPT_ANY_EDGE };
+}  // namespace gpio
+
+class GPIOPin {
+ public:
+  explicit GPIOPin(uint8_t pin = 0) : pin_(pin) {}
+  virtual ~GPIOPin() = default;
+  virtual void setup() {}
+  virtual void digital_write(bool value) { state_ = value; }
+  virtual bool digital_read() { return state_; }
+  virtual std::string dump_summary() const { return "GPIO" + std::to_string(pin_); }
+  uint8_t get_pin() const { return pin_; }
+
+ protected:
+  uint8_t pin_;
+  bool state_{false};
+};
+
+// Interrupt handlers attached to the pin are called by the harness with edge(), in place of the hardware
+class InternalGPIOPin : public GPIOPin {
+ public:
+  using GPIOPin::GPIOPin;
+
+  template<typename T> void attach_interrupt(void (*func)(T *), T *arg, gpio::InterruptType type) const {
+    handlers_.push_back({reinterpret_cast<void (*)(void *)>(func), arg, type});
+  }
+  void detach_interrupt() const { handlers_.clear(); }
+
+  // Host only: sets the level and calls the handlers interested in the resulting edge
+  void edge(bool rising) {
+    state_ = rising;
+    for (const auto &handler : handlers_) {
+      if (handler.type == gpio::INTERRUPT_ANY_EDGE || (handler.type == gpio::INTERRUPT_RISING_EDGE) == rising)
+        handler.func(handler.arg);
+    }
+  }
+
+ protected:
+  struct Handler {
+    void (*func)(void *);
+    void *arg;
+    gpio::InterruptType type;
+  };
+  mutable std::vector<Handler> handlers_;
+};
+
+}  // namespace esphome
@@ -0,0 +1,51 @@
+#pragma once
+
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <utility>
+#include <vector>
+
+namespace esphome {
+
+template<typename T> class Parented {
+ public:
+  Parented() = default;
+  explicit Parented(T *parent) : parent_(parent) {}
+  T *get_parent() const { return parent_; }
+  void set_parent(T *parent) { parent_ = parent; }
+
+ protected:
+  T *parent_{nullptr};
+};
+
+template<typename... X> class CallbackManager;
+template<typename... Ts> class CallbackManager<void(Ts...)> {
+ public:
+  void add(std::function<void(Ts...)> &&callback) { callbacks_.push_back(std::move(callback)); }
+  void call(Ts... args) {
+    for (auto &callback : callbacks_)
+      callback(args...);
+  }
+  size_t size() const { return callbacks_.size(); }
+
+ protected:
+  std::vector<std::function<void(Ts...)>> callbacks_;
+};
+
+// The simulation is single threaded, interrupts are plain calls
+class InterruptLock {
+ public:
+  // Not defaulted, like on the device a lock is never an unused variable
+  InterruptLock() {}
+  ~InterruptLock() {}
+};
+
+template<typename T> T clamp(T value, T min, T max) { return value < min ? min : (value > max ? max : value); }
+
+uint32_t fnv1_hash(const std::string &str);
+std::string base64_encode(const uint8_t *buf, size_t buf_len);
+std::vector<uint8_t> base64_decode(const std::string &encoded);
+
+}  // namespace esphome
@@ -0,0 +1,47 @@
+#pragma once
+
+#include <cstdint>
+#include <cstring>
+#include <map>
+#include <vector>
+
+namespace esphome {
+
+// Preferences live in memory for the lifetime of the process, so a component set up again restores what it saved
+class ESPPreferenceObject {
+ public:
+  ESPPreferenceObject() = default;
+  explicit ESPPreferenceObject(std::vector<uint8_t> *data) : data_(data) {}
+
+  template<typename T> bool save(const T *src) {
+    if (data_ == nullptr)
+      return false;
+    data_->assign(reinterpret_cast<const uint8_t *>(src), reinterpret_cast<const uint8_t *>(src) + sizeof(T));
+    return true;
+  }
+  template<typename T> bool load(T *dest) {
+    if (data_ == nullptr || data_->size() != sizeof(T))
+      return false;
+    memcpy(dest, data_->data(), sizeof(T));
+    return true;
+  }
+
+ protected:
+  std::vector<uint8_t> *data_{nullptr};
+};
+
+class ESPPreferences {
+ public:
+  template<typename T> ESPPreferenceObject make_preference(uint32_t type, bool in_flash = false) {
+    return ESPPreferenceObject(&data_[type]);
+  }
+  // Host only: forgets everything saved
+  void clear() { data_.clear(); }
+
+ protected:
+  std::map<uint32_t, std::vector<uint8_t>> data_;
+};
+
+extern ESPPreferences *global_preferences;
+
+}  // namespace esphome